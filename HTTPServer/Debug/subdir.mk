@@ -4,19 +4,64 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
+../appendlog.c \
+../authcache.c \
 ../base64.c \
+../body.c \
+../clienttable.c \
+../compress.c \
+../config.c \
+../encoding.c \
+../form.c \
+../fsops.c \
+../multipart.c \
+../range.c \
+../realm.c \
 ../server.c \
-../time.c 
+../sharedmutex.c \
+../stats.c \
+../time.c \
+../upload.c 
 
 OBJS += \
+./appendlog.o \
+./authcache.o \
 ./base64.o \
+./body.o \
+./clienttable.o \
+./compress.o \
+./config.o \
+./encoding.o \
+./form.o \
+./fsops.o \
+./multipart.o \
+./range.o \
+./realm.o \
 ./server.o \
-./time.o 
+./sharedmutex.o \
+./stats.o \
+./time.o \
+./upload.o 
 
 C_DEPS += \
+./appendlog.d \
+./authcache.d \
 ./base64.d \
+./body.d \
+./clienttable.d \
+./compress.d \
+./config.d \
+./encoding.d \
+./form.d \
+./fsops.d \
+./multipart.d \
+./range.d \
+./realm.d \
 ./server.d \
-./time.d 
+./sharedmutex.d \
+./stats.d \
+./time.d \
+./upload.d 
 
 
 # Each subdirectory must supply rules for building sources it contributes
@@ -0,0 +1,322 @@
+#include "headers.h"
+#include "structures.h"
+#include "prototypes.h"
+
+/* number of neighbouring slots a file may be placed in */
+static const int appendLogWays = 8;
+
+/* a sync running longer than this is assumed to be abandoned */
+static const long long appendSyncTimeout = 1000000;
+
+/*!
+ * Waits until the log can be used exclusively. The lock is released by the
+ * system if its holder dies; a sync it was leading counts as abandoned once
+ * appendSyncTimeout passes, so the state stays usable
+ * @param log Log to lock
+ */
+static void appendLogLock(AppendLog *log) {
+	if (pthread_mutex_lock(&log->lock) == EOWNERDEAD)
+		pthread_mutex_consistent(&log->lock);
+}
+
+/*!
+ * Lets other processes use the log
+ * @param log Log to unlock
+ */
+static void appendLogUnlock(AppendLog *log) {
+	pthread_mutex_unlock(&log->lock);
+}
+
+/*!
+ * Creates group commit state in shared memory, so that it is seen by every
+ * process forked afterwards
+ * @param size Number of files tracked at once
+ * @param durability When appends are synced
+ * @param interval Shortest time between syncs of a file, in milliseconds
+ * @param stats Statistics to update, may be 0
+ * @return Pointer to the log, 0 if shared memory could not be created
+ */
+AppendLog* appendLogCreate(int size, enum Durability durability, int interval,
+		Stats *stats) {
+	AppendLog *log = (AppendLog*) sharedAlloc(sizeof(AppendLog) + size
+			* sizeof(AppendFile));
+	if (!log)
+		return 0;
+	if (initSharedMutex(&log->lock)) {
+		shmdt(log);
+		return 0;
+	}
+	log->durability = durability;
+	log->interval = interval * 1000LL;
+	log->size = size;
+	log->stats = stats;
+	return log;
+}
+
+/*!
+ * Finds the slot of a file, taking a free or idle one if the file has none.
+ * A slot somebody waits on is never taken, as the waiter still refers to it;
+ * one pinned by a process which died waiting only stops syncs of the files
+ * hashed to it from being shared. Must be called with the log locked
+ * @param log Log to search
+ * @param attrib Attributes of the file
+ * @return Slot of the file, 0 if all candidate slots are busy
+ */
+static AppendFile* appendLogFind(AppendLog *log, const struct stat *attrib) {
+	unsigned int start = (unsigned int) (attrib->st_ino * 2654435761u
+			^ attrib->st_dev);
+	AppendFile *spare = 0;
+	int i;
+	for (i = 0; i < appendLogWays && i < log->size; ++i) {
+		AppendFile *file = &log->file[(start + i) % log->size];
+		if (file->ino == attrib->st_ino && file->dev == attrib->st_dev)
+			return file;
+		if (!spare && (!file->ino || (!file->waiters && !file->syncStart
+				&& file->syncedSeq == file->writeSeq)))
+			spare = file;
+	}
+	if (spare) {
+		memset(spare, 0, sizeof(AppendFile));
+		spare->dev = attrib->st_dev;
+		spare->ino = attrib->st_ino;
+	}
+	return spare;
+}
+
+/*!
+ * Waits until an append is on disk. The first waiter syncs the file for
+ * everybody who appended to it in the meantime, so concurrent appends share
+ * one fdatasync()
+ * @param log Group commit state
+ * @param fd File the append was written to
+ * @return 0 on success, -1 if the sync failed
+ */
+static int appendLogSync(AppendLog *log, int fd) {
+	struct stat attrib;
+	if (fstat(fd, &attrib))
+		return -1;
+
+	appendLogLock(log);
+	AppendFile *file = appendLogFind(log, &attrib);
+	if (!file) {
+		appendLogUnlock(log);
+		if (log->stats)
+			__sync_fetch_and_add(&log->stats->appendSyncs, 1);
+		return fdatasync(fd);
+	}
+	/* the write is complete, so a sync starting from now covers it */
+	unsigned long seq = ++file->writeSeq;
+	++file->waiters;
+
+	while (file->syncedSeq < seq) {
+		long long now = nowMicros();
+		if (file->syncStart && now - file->syncStart < appendSyncTimeout) {
+			/* somebody else is syncing, wait for the result */
+			appendLogUnlock(log);
+			usleep(100);
+			appendLogLock(log);
+			continue;
+		}
+
+		/* become the leader, giving others a while to join */
+		file->syncStart = now;
+		long long wait = file->lastSync + log->interval - now;
+		appendLogUnlock(log);
+		if (wait > 0)
+			usleep(wait);
+
+		appendLogLock(log);
+		unsigned long target = file->writeSeq;
+		appendLogUnlock(log);
+		int result = fdatasync(fd);
+		if (log->stats)
+			__sync_fetch_and_add(&log->stats->appendSyncs, 1);
+
+		appendLogLock(log);
+		file->syncStart = 0;
+		file->lastSync = nowMicros();
+		if (result) {
+			--file->waiters;
+			appendLogUnlock(log);
+			return -1;
+		}
+		if (file->syncedSeq < target)
+			file->syncedSeq = target;
+	}
+	--file->waiters;
+	appendLogUnlock(log);
+	return 0;
+}
+
+/*!
+ * Prepares appending of a line to a file
+ * @param writer Writer to initialize
+ * @param log Group commit state, 0 to append without syncing
+ * @param fd File opened with O_APPEND
+ */
+void appendInit(AppendWriter *writer, AppendLog *log, int fd) {
+	writer->log = log;
+	writer->stats = log ? log->stats : 0;
+	writer->fd = fd;
+	writer->length = 0;
+	writer->error = 0;
+	writer->spool = -1;
+}
+
+/*!
+ * Adds a piece of the line. Pieces are staged, so a line fitting the buffer
+ * reaches the file in a single write, which O_APPEND makes atomic. A longer
+ * line is spooled to a temporary file, as it may arrive slowly, and copied
+ * to the file only when complete
+ * @param writer Writer
+ * @param data Piece of the line
+ * @param len Length of the piece
+ * @return 0 on success, -1 if a write failed
+ */
+int appendWrite(AppendWriter *writer, const char *data, int len) {
+	while (!writer->error && len > 0) {
+		if (writer->length == sizeof(writer->buffer)) {
+			/* the line doesn't fit, move what is staged to the spool */
+			if (writer->spool < 0) {
+				char name[] = P_tmpdir "/appendXXXXXX";
+				writer->spool = mkstemp(name);
+				if (writer->spool < 0) {
+					writer->error = -1;
+					break;
+				}
+				unlink(name);
+			}
+			if (fsWrite(writer->spool, writer->buffer, writer->length))
+				writer->error = -1;
+			writer->length = 0;
+		}
+		int size = sizeof(writer->buffer) - writer->length;
+		if (size > len)
+			size = len;
+		memcpy(&writer->buffer[writer->length], data, size);
+		writer->length += size;
+		data += size;
+		len -= size;
+	}
+	return writer->error;
+}
+
+/*!
+ * Writes a spooled line to the file. The file is locked exclusively, as the
+ * line takes many writes, so that lines never interleave. Only local files
+ * are read meanwhile, never the client
+ * @param writer Writer with the beginning of the line in the spool
+ * @return 0 on success, -1 on failure, with the file left as it was
+ */
+static int appendSpooled(AppendWriter *writer) {
+	struct stat attrib;
+	off_t spooled = lseek(writer->spool, 0, SEEK_END);
+	if (spooled < 0 || flock(writer->fd, LOCK_EX))
+		return -1;
+	if (fstat(writer->fd, &attrib)) {
+		flock(writer->fd, LOCK_UN);
+		return -1;
+	}
+
+	/* sendfile() can't write to files opened with O_APPEND */
+	int result = 0;
+	off_t offset = 0;
+	char *chunk = (char*) malloc(appendBufferSize);
+	while (!result && offset < spooled) {
+		ssize_t size = pread(writer->spool, chunk, appendBufferSize, offset);
+		if (size < 0 && errno == EINTR)
+			continue;
+		if (size <= 0 || fsWrite(writer->fd, chunk, size))
+			result = -1;
+		offset += size;
+	}
+	free(chunk);
+	if (!result && (fsWrite(writer->fd, writer->buffer, writer->length)
+			|| fsWrite(writer->fd, "\n", 1)))
+		result = -1;
+	/* nobody else appends meanwhile, so a partial line can be cut off */
+	if (result && ftruncate(writer->fd, attrib.st_size))
+		writer->error = -1;
+	flock(writer->fd, LOCK_UN);
+
+	if (!result && writer->stats)
+		__sync_fetch_and_add(&writer->stats->appendBytes, spooled);
+	return result;
+}
+
+/*!
+ * Ends the line and writes it, syncing it as configured in the log
+ * @param writer Writer
+ * @return 0 once the line is written (and durable, if required), -1 on failure
+ */
+int appendCommit(AppendWriter *writer) {
+	long long start = nowMicros();
+	struct iovec line[2] = { { writer->buffer, writer->length }, {
+			(void*) "\n", 1 } };
+	int size = writer->length + 1;
+	if (writer->error)
+		return -1;
+	if (writer->spool >= 0) {
+		int result = appendSpooled(writer);
+		appendAbort(writer);
+		if (result)
+			return writer->error = -1;
+	} else {
+		if (flock(writer->fd, LOCK_SH))
+			return writer->error = -1;
+		int written = writev(writer->fd, line, 2);
+		flock(writer->fd, LOCK_UN);
+		writer->length = 0;
+		if (written != size)
+			return writer->error = -1;
+	}
+	if (writer->stats) {
+		__sync_fetch_and_add(&writer->stats->appends, 1);
+		__sync_fetch_and_add(&writer->stats->appendBytes, size);
+	}
+
+	if (!writer->log || writer->log->durability == durabilityNone)
+		return 0;
+	int result;
+	if (writer->log->durability == durabilityRequest) {
+		result = fdatasync(writer->fd);
+		if (writer->stats)
+			__sync_fetch_and_add(&writer->stats->appendSyncs, 1);
+	} else
+		result = appendLogSync(writer->log, writer->fd);
+	if (result)
+		return writer->error = -1;
+
+	if (writer->stats)
+		histogramRecord(&writer->stats->appendCommit, nowMicros() - start);
+	return 0;
+}
+
+/*!
+ * Drops a line which was not committed. The file is not touched, as only
+ * complete lines are written to it
+ * @param writer Writer
+ */
+void appendAbort(AppendWriter *writer) {
+	if (writer->spool >= 0) {
+		close(writer->spool);
+		writer->spool = -1;
+	}
+	writer->length = 0;
+}
+
+/*!
+ * Gets length of a file appended to by appendCommit(). The length never ends
+ * in the middle of a line: the file is locked exclusively, as a long line
+ * grows the file page by page during its write, under a shared lock
+ * @param fd The file
+ * @return Length of the file, -1 on failure
+ */
+off_t appendedLength(int fd) {
+	struct stat attrib;
+	if (flock(fd, LOCK_EX))
+		return -1;
+	int result = fstat(fd, &attrib);
+	flock(fd, LOCK_UN);
+	return result ? -1 : attrib.st_size;
+}
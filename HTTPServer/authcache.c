@@ -0,0 +1,149 @@
+#include "headers.h"
+#include "structures.h"
+#include "prototypes.h"
+
+/* number of neighbouring slots an entry may be placed in */
+static const int authCacheWays = 4;
+
+/*!
+ * Computes FNV-1a hash of given data
+ * @param data Pointer to data
+ * @param len Length of data
+ * @return Hash value
+ */
+static unsigned int hashBytes(const char *data, int len) {
+	unsigned int hash = 2166136261u;
+	int i;
+	for (i = 0; i < len; ++i) {
+		hash ^= (unsigned char) data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/*!
+ * Waits until the cache can be used exclusively. The lock is released by
+ * the system if its holder dies; entries it may have left half written are
+ * dropped then
+ * @param cache Cache to lock
+ */
+static void authCacheLock(AuthCache *cache) {
+	if (pthread_mutex_lock(&cache->lock) == EOWNERDEAD) {
+		int i;
+		for (i = 0; i < cache->size; ++i)
+			cache->entry[i].generation = 0;
+		pthread_mutex_consistent(&cache->lock);
+	}
+}
+
+/*!
+ * Lets other processes use the cache
+ * @param cache Cache to unlock
+ */
+static void authCacheUnlock(AuthCache *cache) {
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/*!
+ * Creates a cache of verified credentials in shared memory, so that it is
+ * seen by every process forked afterwards
+ * @param size Number of entries
+ * @return Pointer to the cache, 0 if shared memory could not be created
+ */
+AuthCache* authCacheCreate(int size) {
+	AuthCache *cache = (AuthCache*) sharedAlloc(sizeof(AuthCache) + size
+			* sizeof(AuthCacheEntry));
+	if (!cache)
+		return 0;
+	if (initSharedMutex(&cache->lock)) {
+		shmdt(cache);
+		return 0;
+	}
+	cache->size = size;
+	return cache;
+}
+
+/*!
+ * Checks whether given Authorization header value was already verified for a
+ * realm and the verification has not expired yet
+ * @param cache Cache to search
+ * @param credentials Raw value of the Authorization header
+ * @param len Length of the value
+ * @param realm Index of the realm
+ * @param generation Configuration snapshot the realm index refers to
+ * @return true on a hit, false otherwise
+ */
+int authCacheLookup(AuthCache *cache, const char *credentials, int len,
+		int realm, int generation) {
+	if (!cache || len >= sizeof(cache->entry[0].credentials))
+		return false;
+
+	unsigned int hash = hashBytes(credentials, len);
+	time_t current = time(0);
+	int found = false;
+	int i;
+
+	authCacheLock(cache);
+	for (i = 0; i < authCacheWays && !found; ++i) {
+		AuthCacheEntry *entry = &cache->entry[(hash + i) % cache->size];
+		found = (entry->generation == generation && entry->hash == hash
+				&& entry->realm == realm && entry->expires > current
+				&& entry->len == len && !memcmp(entry->credentials,
+				credentials, len));
+	}
+	authCacheUnlock(cache);
+	return found;
+}
+
+/*!
+ * Remembers a successful verification of an Authorization header value
+ * @param cache Cache to store to
+ * @param credentials Raw value of the Authorization header
+ * @param len Length of the value
+ * @param realm Index of the realm
+ * @param generation Configuration snapshot the realm index refers to; a
+ * request still served with an older snapshot stores entries nobody finds
+ * @param ttl Number of seconds the verification stays valid
+ */
+void authCacheStore(AuthCache *cache, const char *credentials, int len,
+		int realm, int generation, int ttl) {
+	if (!cache || len >= sizeof(cache->entry[0].credentials))
+		return;
+
+	unsigned int hash = hashBytes(credentials, len);
+	int i;
+
+	authCacheLock(cache);
+	/* take a stale slot if there is one, otherwise the one expiring first */
+	AuthCacheEntry *victim = &cache->entry[hash % cache->size];
+	for (i = 0; i < authCacheWays; ++i) {
+		AuthCacheEntry *entry = &cache->entry[(hash + i) % cache->size];
+		if (entry->generation != generation) {
+			victim = entry;
+			break;
+		}
+		if (entry->expires < victim->expires)
+			victim = entry;
+	}
+	victim->generation = generation;
+	victim->hash = hash;
+	victim->realm = realm;
+	victim->expires = time(0) + ttl;
+	victim->len = len;
+	memcpy(victim->credentials, credentials, len);
+	authCacheUnlock(cache);
+}
+
+/*!
+ * Forgets all verified credentials, e.g. after configuration has changed
+ * @param cache Cache to clear
+ */
+void authCacheClear(AuthCache *cache) {
+	if (!cache)
+		return;
+	int i;
+	authCacheLock(cache);
+	for (i = 0; i < cache->size; ++i)
+		cache->entry[i].generation = 0;
+	authCacheUnlock(cache);
+}
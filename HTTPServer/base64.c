@@ -194,58 +194,356 @@
 
  VERSION HISTORY:
  Bob Trower 08/04/01 -- Create Version 0.00.00B
+ Stream decoder replaced with buffer based encoder and decoder which
+ check bounds, reject noise and use SSSE3/AVX2 where available.
 
  \******************************************************************* */
 
-static const char
-		cd64[] =
-				"|$$$}rstuvwxyz{$$$$$$$>?@ABCDEFGHIJKLMNOPQRSTUVW$$$$$$XYZ[\\]^_`abcdefghijklmnopq";
+#include "headers.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BASE64_SIMD
+#endif
+
+static const char encodeTable[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* value of each base64 character, -1 for characters outside the alphabet */
+static const signed char decodeTable[256] = {
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+		52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+		-1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+		15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+		-1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+		41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 };
+
+#ifdef BASE64_SIMD
 
 /*
- ** decodeblock
+ ** decodeSSSE3
  **
- ** decode 4 '6-bit' characters into 3 8-bit binary bytes
+ ** decode 16 characters at a time into 12 bytes; 4 more bytes of output are
+ ** overwritten. Stops at the first block containing a character outside the
+ ** alphabet and leaves it to the scalar loop
  */
-void decodeblock(unsigned char in[4], unsigned char out[3]) {
-	out[0] = (unsigned char) (in[0] << 2 | in[1] >> 4);
-	out[1] = (unsigned char) (in[1] << 4 | in[2] >> 2);
-	out[2] = (unsigned char) (((in[2] << 6) & 0xc0) | in[3]);
+__attribute__((target("ssse3")))
+static int decodeSSSE3(const char *in, int inLen, unsigned char *out,
+		int outSize) {
+	/* bit sets of lower and higher nibbles; a character is invalid when the
+	 * sets of its nibbles intersect */
+	const __m128i lutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+			0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+	const __m128i lutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+			0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	/* offset added to a character to get its value, by higher nibble */
+	const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0,
+			0, 0, 0, 0, 0, 0, 0);
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+	const __m128i slash = _mm_set1_epi8('/');
+	const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13,
+			12, -1, -1, -1, -1);
+	int i = 0, o = 0;
+
+	while (inLen - i >= 16 && outSize - o >= 16) {
+		__m128i str = _mm_loadu_si128((const __m128i*) &in[i]);
+		__m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(str, 4), nibble);
+		__m128i loNibbles = _mm_and_si128(str, nibble);
+		__m128i invalid = _mm_and_si128(_mm_shuffle_epi8(lutLo, loNibbles),
+				_mm_shuffle_epi8(lutHi, hiNibbles));
+		if (_mm_movemask_epi8(_mm_cmpgt_epi8(invalid, _mm_setzero_si128())))
+			break;
+
+		/* characters to 6-bit values */
+		__m128i roll = _mm_shuffle_epi8(lutRoll, _mm_add_epi8(_mm_cmpeq_epi8(
+				str, slash), hiNibbles));
+		str = _mm_add_epi8(str, roll);
+
+		/* 4 x 6 bits to 3 x 8 bits in every 32-bit lane */
+		str = _mm_maddubs_epi16(str, _mm_set1_epi32(0x01400140));
+		str = _mm_madd_epi16(str, _mm_set1_epi32(0x00011000));
+		_mm_storeu_si128((__m128i*) &out[o], _mm_shuffle_epi8(str, pack));
+
+		i += 16;
+		o += 12;
+	}
+	return i;
+}
+
+/*
+ ** decodeAVX2
+ **
+ ** the same as decodeSSSE3, but 32 characters into 24 bytes at a time
+ */
+__attribute__((target("avx2")))
+static int decodeAVX2(const char *in, int inLen, unsigned char *out,
+		int outSize) {
+	const __m256i lutLo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11,
+			0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+			0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13,
+			0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+	const __m256i lutHi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04,
+			0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+			0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10,
+			0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m256i lutRoll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71,
+			-71, 0, 0, 0, 0, 0, 0, 0, 0, 0, 16, 19, 4, -65, -65, -71, -71, 0, 0,
+			0, 0, 0, 0, 0, 0);
+	const __m256i nibble = _mm256_set1_epi8(0x0F);
+	const __m256i slash = _mm256_set1_epi8('/');
+	const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13,
+			12, -1, -1, -1, -1, 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1,
+			-1, -1);
+	/* moves 12 bytes of the upper lane right after 12 bytes of the lower one */
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+	int i = 0, o = 0;
+
+	while (inLen - i >= 32 && outSize - o >= 32) {
+		__m256i str = _mm256_loadu_si256((const __m256i*) &in[i]);
+		__m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4),
+				nibble);
+		__m256i loNibbles = _mm256_and_si256(str, nibble);
+		__m256i invalid = _mm256_and_si256(
+				_mm256_shuffle_epi8(lutLo, loNibbles), _mm256_shuffle_epi8(
+						lutHi, hiNibbles));
+		if (_mm256_movemask_epi8(_mm256_cmpgt_epi8(invalid,
+				_mm256_setzero_si256())))
+			break;
+
+		__m256i roll = _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(
+				_mm256_cmpeq_epi8(str, slash), hiNibbles));
+		str = _mm256_add_epi8(str, roll);
+
+		str = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+		str = _mm256_madd_epi16(str, _mm256_set1_epi32(0x00011000));
+		str = _mm256_shuffle_epi8(str, pack);
+		_mm256_storeu_si256((__m256i*) &out[o], _mm256_permutevar8x32_epi32(
+				str, lanes));
+
+		i += 32;
+		o += 24;
+	}
+	return i;
+}
+
+/*
+ ** encodeSSSE3
+ **
+ ** encode 12 bytes at a time into 16 characters; reads 4 bytes past the
+ ** group, so at least 16 bytes of input have to be left
+ */
+__attribute__((target("ssse3")))
+static int encodeSSSE3(const unsigned char *in, int inLen, char *out) {
+	/* offset added to a 6-bit value to get its character */
+	const __m128i lutShift = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0'
+			- 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+			'0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+	const __m128i spread = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7,
+			10, 9, 11, 10);
+	int i = 0, o = 0;
+
+	while (inLen - i >= 16) {
+		__m128i str = _mm_shuffle_epi8(_mm_loadu_si128(
+				(const __m128i*) &in[i]), spread);
+
+		/* 3 x 8 bits to 4 x 6 bits in every 32-bit lane */
+		__m128i t0 = _mm_mulhi_epu16(_mm_and_si128(str, _mm_set1_epi32(
+				0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+		__m128i t1 = _mm_mullo_epi16(_mm_and_si128(str, _mm_set1_epi32(
+				0x003f03f0)), _mm_set1_epi32(0x01000010));
+		__m128i values = _mm_or_si128(t0, t1);
+
+		/* 6-bit values to characters */
+		__m128i index = _mm_subs_epu8(values, _mm_set1_epi8(51));
+		__m128i isUpper = _mm_cmpgt_epi8(_mm_set1_epi8(26), values);
+		index = _mm_or_si128(index, _mm_and_si128(isUpper, _mm_set1_epi8(13)));
+		str = _mm_add_epi8(values, _mm_shuffle_epi8(lutShift, index));
+		_mm_storeu_si128((__m128i*) &out[o], str);
+
+		i += 12;
+		o += 16;
+	}
+	return i;
+}
+
+/*
+ ** encodeAVX2
+ **
+ ** the same as encodeSSSE3, but 24 bytes into 32 characters at a time;
+ ** at least 28 bytes of input have to be left
+ */
+__attribute__((target("avx2")))
+static int encodeAVX2(const unsigned char *in, int inLen, char *out) {
+	const __m256i lutShift = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+			'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0'
+					- 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0, 'a' - 26, '0'
+					- 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0'
+					- 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A',
+			0, 0);
+	const __m256i spread = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8,
+			7, 10, 9, 11, 10, 1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	int i = 0, o = 0;
+
+	while (inLen - i >= 28) {
+		__m256i str = _mm256_inserti128_si256(_mm256_castsi128_si256(
+				_mm_loadu_si128((const __m128i*) &in[i])), _mm_loadu_si128(
+				(const __m128i*) &in[i + 12]), 1);
+		str = _mm256_shuffle_epi8(str, spread);
+
+		__m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(str,
+				_mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+		__m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(str,
+				_mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+		__m256i values = _mm256_or_si256(t0, t1);
+
+		__m256i index = _mm256_subs_epu8(values, _mm256_set1_epi8(51));
+		__m256i isUpper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), values);
+		index = _mm256_or_si256(index, _mm256_and_si256(isUpper,
+				_mm256_set1_epi8(13)));
+		str = _mm256_add_epi8(values, _mm256_shuffle_epi8(lutShift, index));
+		_mm256_storeu_si256((__m256i*) &out[o], str);
+
+		i += 24;
+		o += 32;
+	}
+	return i;
 }
 
+/* best instruction set supported by the processor: 0 none, 1 SSSE3, 2 AVX2 */
+static int simdLevel = -1;
+
 /*
- ** decode
+ ** base64Simd
  **
- ** decode a base64 encoded stream discarding padding, line breaks and noise
+ ** detect the instruction set on first use
  */
-void decode(char *infile, char *outfile) {
-	unsigned char in[4], out[3], v;
-	int i, len;
-	int j = 0, k = 0;
-
-	while (infile[j]) {
-		for (len = 0, i = 0; i < 4 && infile[j]; i++) {
-			v = 0;
-			while (infile[j] && v == 0) {
-				v = (unsigned char) infile[j++];
-				v = (unsigned char) ((v < 43 || v > 122) ? 0 : cd64[v - 43]);
-				if (v) {
-					v = (unsigned char) ((v == '$') ? 0 : v - 61);
-				}
-			}
-			if (infile[j]) {
-				len++;
-				if (v) {
-					in[i] = (unsigned char) (v - 1);
-				}
-			} else {
-				in[i] = 0;
-			}
-		}
-		if (len) {
-			decodeblock(in, out);
-			for (i = 0; i < len - 1; i++) {
-				outfile[k++] = out[i];
-			}
-		}
+static int base64Simd() {
+	if (simdLevel < 0) {
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			simdLevel = 2;
+		else if (__builtin_cpu_supports("ssse3"))
+			simdLevel = 1;
+		else
+			simdLevel = 0;
+	}
+	return simdLevel;
+}
+
+#endif /* BASE64_SIMD */
+
+/*
+ ** base64Decode
+ **
+ ** decode base64 text into a buffer of given size. Padding is optional;
+ ** line breaks, whitespace and any other noise make the input invalid.
+ ** Returns number of decoded bytes, or -1 when the input is not valid
+ ** base64 or the decoded data does not fit in outSize bytes
+ */
+int base64Decode(const char *in, int inLen, unsigned char *out, int outSize) {
+	int i = 0, o = 0;
+
+	/* strip padding */
+	if (inLen > 0 && inLen % 4 == 0 && in[inLen - 1] == '=') {
+		--inLen;
+		if (in[inLen - 1] == '=')
+			--inLen;
+	}
+	if (inLen % 4 == 1)
+		return -1;
+
+	int outLen = inLen / 4 * 3 + (inLen % 4 ? inLen % 4 - 1 : 0);
+	if (outLen > outSize)
+		return -1;
+
+#ifdef BASE64_SIMD
+	switch (base64Simd()) {
+	case 2:
+		i = decodeAVX2(in, inLen, out, outSize);
+		o = i / 4 * 3;
+		/* no break */
+	case 1:
+		i += decodeSSSE3(&in[i], inLen - i, &out[o], outSize - o);
+		o = i / 4 * 3;
+	}
+#endif
+
+	/* remaining full groups of 4 characters */
+	for (; inLen - i >= 4; i += 4) {
+		int a = decodeTable[(unsigned char) in[i]];
+		int b = decodeTable[(unsigned char) in[i + 1]];
+		int c = decodeTable[(unsigned char) in[i + 2]];
+		int d = decodeTable[(unsigned char) in[i + 3]];
+		if ((a | b | c | d) < 0)
+			return -1;
+		unsigned int v = a << 18 | b << 12 | c << 6 | d;
+		out[o++] = (unsigned char) (v >> 16);
+		out[o++] = (unsigned char) (v >> 8);
+		out[o++] = (unsigned char) v;
+	}
+
+	/* last 2 or 3 characters */
+	if (inLen - i > 1) {
+		int a = decodeTable[(unsigned char) in[i]];
+		int b = decodeTable[(unsigned char) in[i + 1]];
+		int c = inLen - i == 3 ? decodeTable[(unsigned char) in[i + 2]] : 0;
+		if ((a | b | c) < 0)
+			return -1;
+		unsigned int v = a << 18 | b << 12 | c << 6;
+		out[o++] = (unsigned char) (v >> 16);
+		if (inLen - i == 3)
+			out[o++] = (unsigned char) (v >> 8);
+	}
+	return o;
+}
+
+/*
+ ** base64Encode
+ **
+ ** encode binary data as padded, null-terminated base64 text. Returns length
+ ** of the text, or -1 when it (with the terminator) does not fit in outSize
+ */
+int base64Encode(const unsigned char *in, int inLen, char *out, int outSize) {
+	int i = 0, o = 0;
+	if (inLen < 0 || (inLen + 2) / 3 * 4 >= outSize)
+		return -1;
+
+#ifdef BASE64_SIMD
+	switch (base64Simd()) {
+	case 2:
+		i = encodeAVX2(in, inLen, out);
+		o = i / 3 * 4;
+		/* no break */
+	case 1:
+		i += encodeSSSE3(&in[i], inLen - i, &out[o]);
+		o = i / 3 * 4;
+	}
+#endif
+
+	for (; inLen - i >= 3; i += 3) {
+		unsigned int v = in[i] << 16 | in[i + 1] << 8 | in[i + 2];
+		out[o++] = encodeTable[v >> 18];
+		out[o++] = encodeTable[(v >> 12) & 0x3f];
+		out[o++] = encodeTable[(v >> 6) & 0x3f];
+		out[o++] = encodeTable[v & 0x3f];
+	}
+	if (inLen - i) {
+		unsigned int v = in[i] << 16 | (inLen - i == 2 ? in[i + 1] << 8 : 0);
+		out[o++] = encodeTable[v >> 18];
+		out[o++] = encodeTable[(v >> 12) & 0x3f];
+		out[o++] = inLen - i == 2 ? encodeTable[(v >> 6) & 0x3f] : '=';
+		out[o++] = '=';
 	}
+	out[o] = 0;
+	return o;
 }
@@ -0,0 +1,144 @@
+/*
+ * appendbench.c
+ *
+ * Stress benchmark of concurrent appends: many processes append lines to one
+ * file through appendCommit(), checking the read-back length after every
+ * line, then every line of the file is verified to be whole and in order.
+ * Built with "make bench" in Debug; the file is created in the directory
+ * given as the argument, the current one by default
+ */
+
+#include "headers.h"
+#include "structures.h"
+#include "prototypes.h"
+
+enum {
+	linesPerWorker = 2000, /// lines each process appends
+	shortLength = 40, /// length of usual lines
+	longLength = 200 * 1024 /// length of lines spilling out of the buffer
+};
+
+/*!
+ * Appends lines to a file as a worker process handling POST requests would.
+ * A line consists of the worker number, the line number, the length and
+ * filler, so it can be verified afterwards
+ * @param path File to append to
+ * @param worker Number of the worker
+ * @param longEvery Every which line is long, 0 for none
+ * @return 0 on success, 1 if an append failed or a read-back length ended
+ * inside a line
+ */
+static int appendLines(const char *path, int worker, int longEvery) {
+	AppendWriter *writer = (AppendWriter*) malloc(sizeof(AppendWriter));
+	char *filler = (char*) malloc(longLength);
+	memset(filler, 'a' + worker % 26, longLength);
+	int fd = open(path, O_RDWR | O_APPEND);
+	int line;
+	for (line = 0; fd >= 0 && line < linesPerWorker; ++line) {
+		int length = longEvery && line % longEvery == longEvery - 1 ? longLength
+				: shortLength;
+		char head[64];
+		int headLength = sprintf(head, "%d %d %d ", worker, line, length);
+
+		/* the line arrives in pieces, like a form field */
+		appendInit(writer, 0, fd);
+		appendWrite(writer, head, headLength);
+		int written;
+		for (written = 0; written < length; written += 4096)
+			appendWrite(writer, filler, length - written < 4096 ? length
+					- written : 4096);
+		if (appendCommit(writer))
+			return 1;
+
+		char last;
+		off_t size = appendedLength(fd);
+		if (size <= 0 || pread(fd, &last, 1, size - 1) != 1 || last != '\n')
+			return 1;
+	}
+	return fd < 0;
+}
+
+/*!
+ * Checks that the file consists of whole lines, each worker's in order
+ * @param path The file
+ * @param workers Number of workers
+ * @param longEvery Every which line is long, 0 for none
+ * @return Number of bad lines, -1 if the file can't be read
+ */
+static long long verifyLines(const char *path, int workers, int longEvery) {
+	FILE *file = fopen(path, "r");
+	if (!file)
+		return -1;
+	int *next = (int*) calloc(workers, sizeof(int));
+	char *line = (char*) malloc(longLength + 64);
+	long long bad = 0;
+	int i;
+	while (fgets(line, longLength + 64, file)) {
+		int worker, number, length, headLength;
+		if (sscanf(line, "%d %d %d %n", &worker, &number, &length,
+				&headLength) != 3 || worker < 0 || worker >= workers
+				|| number != next[worker]) {
+			++bad;
+			continue;
+		}
+		++next[worker];
+		int expected = longEvery && number % longEvery == longEvery - 1
+				? longLength : shortLength;
+		int whole = length == expected && strlen(line) == headLength + length
+				+ 1;
+		for (i = 0; whole && i < length; ++i)
+			whole = line[headLength + i] == 'a' + worker % 26;
+		bad += !whole;
+	}
+	for (i = 0; i < workers; ++i)
+		bad += next[i] != linesPerWorker;
+	fclose(file);
+	free(next);
+	free(line);
+	return bad;
+}
+
+int main(int argc, char *argv[]) {
+	const struct {
+		int workers;
+		int longEvery;
+	} runs[] = { { 1, 0 }, { 4, 0 }, { 16, 0 }, { 64, 0 }, { 4, 10 },
+			{ 16, 10 } };
+	const char *directory = argc > 1 ? argv[1] : ".";
+	int r, i;
+
+	for (r = 0; r < sizeof(runs) / sizeof(runs[0]); ++r) {
+		char path[256];
+		snprintf(path, sizeof(path), "%s/appendXXXXXX", directory);
+		int fd = mkstemp(path);
+		if (fd < 0) {
+			printf("Couldn't create a file in %s\n", directory);
+			return 1;
+		}
+		close(fd);
+
+		int failed = 0;
+		fflush(stdout);
+		long long start = nowMicros();
+		for (i = 0; i < runs[r].workers; ++i)
+			if (!fork())
+				_exit(appendLines(path, i, runs[r].longEvery));
+		for (i = 0; i < runs[r].workers; ++i) {
+			int status;
+			wait(&status);
+			failed += !WIFEXITED(status) || WEXITSTATUS(status);
+		}
+		long long elapsed = nowMicros() - start;
+
+		long long bad = verifyLines(path, runs[r].workers, runs[r].longEvery);
+		unlink(path);
+		long long lines = (long long) runs[r].workers * linesPerWorker;
+		printf("%3d processes, %-22s: %9.0f lines/s, %d failed, %lld bad "
+			"lines\n", runs[r].workers, runs[r].longEvery
+				? "every 10th line 200 KB" : "40-byte lines", lines * 1000000.0
+				/ elapsed, failed, bad);
+		if (failed || bad)
+			return 1;
+	}
+	return 0;
+}
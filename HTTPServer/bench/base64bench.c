@@ -0,0 +1,65 @@
+/*
+ * base64bench.c
+ *
+ * Measures base64 decoding and encoding of 16 B, 1 KB and 1 MB inputs on
+ * every code path the processor supports. Built with "make bench" in Debug
+ */
+
+/* the codec is included, so the benchmark can pick the instruction set */
+#include "base64.c"
+#include "structures.h"
+#include "prototypes.h"
+
+/* bytes processed per measurement, whatever the size of the input */
+static const long long benchVolume = 256 << 20;
+
+int main(int argc, char *argv[]) {
+	const int sizes[] = { 16, 1024, 1 << 20 };
+	const char *levels[] = { "scalar", "SSSE3", "AVX2" };
+	int best = 0, level, s, i;
+#ifdef BASE64_SIMD
+	best = base64Simd();
+#endif
+
+	srand(1);
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+		int size = sizes[s];
+		int textSize = (size + 2) / 3 * 4 + 1;
+		unsigned char *data = (unsigned char*) malloc(size);
+		unsigned char *decoded = (unsigned char*) malloc(size);
+		char *text = (char*) malloc(textSize);
+		for (i = 0; i < size; ++i)
+			data[i] = rand();
+		int textLength = base64Encode(data, size, text, textSize);
+		int rounds = benchVolume / size;
+
+		for (level = 0; level <= best; ++level) {
+#ifdef BASE64_SIMD
+			simdLevel = level;
+#endif
+			if (base64Decode(text, textLength, decoded, size) != size
+					|| memcmp(decoded, data, size)) {
+				printf("%s decoder is broken\n", levels[level]);
+				return 1;
+			}
+
+			long long start = nowMicros();
+			for (i = 0; i < rounds; ++i)
+				base64Decode(text, textLength, decoded, size);
+			long long decodeTime = nowMicros() - start;
+
+			start = nowMicros();
+			for (i = 0; i < rounds; ++i)
+				base64Encode(data, size, text, textSize);
+			long long encodeTime = nowMicros() - start;
+
+			printf("%8d B %-6s decode %6.2f GB/s, encode %6.2f GB/s\n", size,
+					levels[level], (double) textLength * rounds / decodeTime
+							/ 1000, (double) size * rounds / encodeTime / 1000);
+		}
+		free(data);
+		free(decoded);
+		free(text);
+	}
+	return 0;
+}
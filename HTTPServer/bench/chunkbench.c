@@ -0,0 +1,113 @@
+/*
+ * chunkbench.c
+ *
+ * Measures decoding of chunked request bodies by bodyRead(), with many tiny
+ * chunks and with few large ones. Built with "make bench" in Debug
+ */
+
+#include "headers.h"
+#include "structures.h"
+#include "prototypes.h"
+
+/*!
+ * Encodes a payload with chunked transfer coding
+ * @param payload Data to encode
+ * @param length Length of the data
+ * @param chunkSize Size of every chunk but the last one
+ * @param encodedLength Will contain length of the encoded body
+ * @return Encoded body, to be freed by the caller
+ */
+static char* chunkEncode(const char *payload, long long length, int chunkSize,
+		long long *encodedLength) {
+	long long chunks = (length + chunkSize - 1) / chunkSize;
+	char *body = (char*) malloc(length + chunks * 16 + 64);
+	long long offset, size = 0;
+	for (offset = 0; offset < length; offset += chunkSize) {
+		int piece = length - offset < chunkSize ? length - offset : chunkSize;
+		size += sprintf(&body[size], "%x\r\n", piece);
+		memcpy(&body[size], &payload[offset], piece);
+		size += piece;
+		body[size++] = '\r';
+		body[size++] = '\n';
+	}
+	size += sprintf(&body[size], "0\r\n\r\n");
+	*encodedLength = size;
+	return body;
+}
+
+/*!
+ * Starts a process sending a body, as a client would
+ * @param sockets Pair of connected sockets, the second one is written to
+ * @param body Body to send
+ * @param length Length of the body
+ * @return Pid of the process
+ */
+static pid_t startSender(int sockets[2], const char *body, long long length) {
+	pid_t pid = fork();
+	if (!pid) {
+		close(sockets[0]);
+		while (length > 0) {
+			int size = length < (1 << 20) ? length : (1 << 20);
+			if (writeAll(sockets[1], body, size))
+				_exit(1);
+			body += size;
+			length -= size;
+		}
+		_exit(0);
+	}
+	close(sockets[1]);
+	return pid;
+}
+
+int main(int argc, char *argv[]) {
+	const struct {
+		int chunkSize;
+		long long length;
+	} runs[] = { { 1, 4 << 20 }, { 16, 16 << 20 }, { 1 << 20, 256 << 20 } };
+	int r;
+	long long i;
+
+	for (r = 0; r < sizeof(runs) / sizeof(runs[0]); ++r) {
+		long long length = runs[r].length, encodedLength;
+		char *payload = (char*) malloc(length);
+		for (i = 0; i < length; ++i)
+			payload[i] = 'a' + i % 26;
+		char *encoded = chunkEncode(payload, length, runs[r].chunkSize,
+				&encodedLength);
+
+		int sockets[2];
+		socketpair(AF_UNIX, SOCK_STREAM, 0, sockets);
+		pid_t sender = startSender(sockets, encoded, encodedLength);
+
+		/* read like the upload path does, checking the decoded data */
+		BodyReader body;
+		bodyInit(&body, sockets[0], 0);
+		body.chunked = true;
+		body.state = chunkStateSize;
+		static char buffer[64 * 1024];
+		long long decoded = 0;
+		int size;
+		long long start = nowMicros();
+		while ((size = bodyRead(&body, buffer, sizeof(buffer))) > 0) {
+			if (decoded + size > length || memcmp(buffer, &payload[decoded],
+					size))
+				break;
+			decoded += size;
+		}
+		long long elapsed = nowMicros() - start;
+
+		close(sockets[0]);
+		waitpid(sender, 0, 0);
+		if (size || decoded != length) {
+			printf("Chunks of %d bytes were decoded wrong\n",
+					runs[r].chunkSize);
+			return 1;
+		}
+		printf("%8d B chunks: %8.1f MB/s of payload, %8.1f MB/s of input\n",
+				runs[r].chunkSize, (double) length / elapsed,
+				(double) encodedLength / elapsed);
+		free(payload);
+		free(encoded);
+	}
+	return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * readbackbench.c
+ *
+ * Measures a POST append followed by the read-back of the whole file, as
+ * sent with sendfile(), on files up to 10 MB, against the one-byte read()
+ * loop it replaced. Built with "make bench" in Debug; the files are created
+ * in the directory given as the argument, the current one by default
+ */
+
+#include "headers.h"
+#include "structures.h"
+#include "prototypes.h"
+
+enum {
+	rounds = 200 /// appends measured for each file size
+};
+
+/*!
+ * Starts a process reading everything from a socket, as a client would
+ * @param sockets Pair of connected sockets, the first one is written to
+ * @return Pid of the process
+ */
+static pid_t startReader(int sockets[2]) {
+	pid_t pid = fork();
+	if (!pid) {
+		char buffer[1 << 16];
+		close(sockets[0]);
+		while (read(sockets[1], buffer, sizeof(buffer)) > 0)
+			;
+		_exit(0);
+	}
+	close(sockets[1]);
+	return pid;
+}
+
+/*!
+ * Sends a file to a socket the way the POST handler does
+ * @param sockd Socket
+ * @param fd File
+ * @return 0 on success, -1 on error
+ */
+static int sendBack(int sockd, int fd) {
+	off_t offset = 0;
+	off_t length = appendedLength(fd);
+	while (offset < length)
+		if (sendfile(sockd, fd, &offset, length - offset) <= 0)
+			return -1;
+	return 0;
+}
+
+/*!
+ * Reads a file back the way the POST handler did before sendfile()
+ * @param sockd Socket
+ * @param fd File
+ * @param size Length of the file
+ * @return 0 on success, -1 on error
+ */
+static int readBackByByte(int sockd, int fd, off_t size) {
+	char *data = (char*) malloc(size);
+	off_t i = 0;
+	lseek(fd, 0, SEEK_SET);
+	while (i < size && read(fd, &data[i], 1) == 1)
+		++i;
+	int result = writeAll(sockd, data, i);
+	free(data);
+	return result;
+}
+
+int main(int argc, char *argv[]) {
+	const off_t sizes[] = { 4 << 10, 1 << 20, 10 << 20 };
+	const char *directory = argc > 1 ? argv[1] : ".";
+	const char phrase[] = "a phrase appended by the benchmark";
+	int s, i;
+
+	signal(SIGPIPE, SIG_IGN);
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+		char path[256];
+		snprintf(path, sizeof(path), "%s/readbackXXXXXX", directory);
+		int fd = mkstemp(path);
+		if (fd < 0) {
+			printf("Couldn't create a file in %s\n", directory);
+			return 1;
+		}
+		unlink(path);
+		/* the handler appends through a descriptor opened with O_APPEND */
+		fcntl(fd, F_SETFL, O_APPEND);
+		char line[100];
+		memset(line, 'x', sizeof(line) - 1);
+		line[sizeof(line) - 1] = '\n';
+		for (i = 0; i < sizes[s] / sizeof(line); ++i)
+			fsWrite(fd, line, sizeof(line));
+
+		int sockets[2];
+		socketpair(AF_UNIX, SOCK_STREAM, 0, sockets);
+		pid_t reader = startReader(sockets);
+
+		AppendWriter *writer = (AppendWriter*) malloc(sizeof(AppendWriter));
+		long long start = nowMicros();
+		for (i = 0; i < rounds; ++i) {
+			appendInit(writer, 0, fd);
+			if (appendWrite(writer, phrase, sizeof(phrase) - 1)
+					|| appendCommit(writer) || sendBack(sockets[0], fd)) {
+				printf("Append or read-back failed\n");
+				return 1;
+			}
+		}
+		long long sendfileTime = nowMicros() - start;
+
+		/* one request is enough to show the cost of a syscall per byte */
+		start = nowMicros();
+		readBackByByte(sockets[0], fd, lseek(fd, 0, SEEK_END));
+		long long byteTime = nowMicros() - start;
+
+		printf("%6lld KB file: sendfile %8.1f us/request, "
+			"1-byte reads %10lld us/request\n", (long long) sizes[s] >> 10,
+				(double) sendfileTime / rounds, byteTime);
+
+		free(writer);
+		close(sockets[0]);
+		waitpid(reader, 0, 0);
+		close(fd);
+	}
+	return 0;
+}
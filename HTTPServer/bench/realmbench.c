@@ -0,0 +1,101 @@
+/*
+ * realmbench.c
+ *
+ * Measures realm lookups with 10k protected paths: the trie against the
+ * linear scan of every URI it replaced. Built with "make bench" in Debug
+ */
+
+#include "headers.h"
+#include "structures.h"
+#include "prototypes.h"
+
+enum {
+	ruleCount = 10000, /// protected paths, a tenth of them prefix rules
+	realmCount = 100, /// realms the rules are spread over
+	requestCount = 4096, /// distinct requested paths
+	rounds = 200 /// passes over the requested paths
+};
+
+/*!
+ * Builds the n-th protected path
+ * @param buffer Buffer for the path
+ * @param size Size of the buffer
+ * @param n Number of the path
+ */
+static void rulePath(char *buffer, int size, int n) {
+	if (n % 10)
+		snprintf(buffer, size, "/site%d/dir%d/page%d.html", n % 97, n % 31,
+				n);
+	else
+		snprintf(buffer, size, "/tree%d/*", n);
+}
+
+/*!
+ * Finds a realm the way createResponse() did before the trie, comparing the
+ * path with every URI of every realm
+ * @param rules Protected paths
+ * @param path Requested path
+ * @return Index of the realm, -1 when the path is not protected
+ */
+static int linearLookup(char rules[][64], const char *path) {
+	int i;
+	for (i = 0; i < ruleCount; ++i)
+		if (!strcmp(rules[i], path))
+			return i % realmCount;
+	return -1;
+}
+
+int main(int argc, char *argv[]) {
+	static char rules[ruleCount][64];
+	static char requests[requestCount][64];
+	Arena arena = { 0 };
+	RealmNode *trie = realmTrieCreate(&arena);
+	int i, r;
+
+	for (i = 0; i < ruleCount; ++i) {
+		rulePath(rules[i], sizeof(rules[i]), i);
+		if (!trie || realmTrieInsert(&arena, trie, rules[i], i % realmCount)) {
+			printf("Not enough memory for the trie\n");
+			return 1;
+		}
+	}
+
+	/* a third of the requests hit exact rules, a third fall under prefix
+	 * rules and the rest aren't protected */
+	for (i = 0; i < requestCount; ++i) {
+		int n = (i * 7919) % ruleCount;
+		if (i % 3 == 0)
+			rulePath(requests[i], sizeof(requests[i]), n | 1);
+		else if (i % 3 == 1)
+			snprintf(requests[i], sizeof(requests[i]), "/tree%d/a/b%d.txt",
+					n - n % 10, i);
+		else
+			snprintf(requests[i], sizeof(requests[i]),
+					"/site%d/dir%d/missing%d.html", n % 97, n % 31, i);
+	}
+
+	long long found = 0;
+	long long start = nowMicros();
+	for (r = 0; r < rounds; ++r)
+		for (i = 0; i < requestCount; ++i) {
+			char path[64];
+			strcpy(path, requests[i]);
+			if (canonicalizePath(path) >= 0)
+				found += realmTrieLookup(trie, path) >= 0;
+		}
+	long long trieTime = nowMicros() - start;
+	printf("trie:   %8.1f ns/lookup (%lld protected)\n", trieTime * 1000.0
+			/ (rounds * (long long) requestCount), found / rounds);
+
+	/* the linear scan is slow enough for a single pass */
+	found = 0;
+	start = nowMicros();
+	for (i = 0; i < requestCount; ++i)
+		found += linearLookup(rules, requests[i]) >= 0;
+	long long linearTime = nowMicros() - start;
+	printf("linear: %8.1f ns/lookup (%lld protected, exact rules only)\n",
+			linearTime * 1000.0 / requestCount, found);
+
+	arenaFree(&arena);
+	return 0;
+}
@@ -0,0 +1,23 @@
+/*
+ * serverstubs.c
+ *
+ * Functions of server.c needed by the modules under benchmark; server.c
+ * itself can't be linked into a benchmark, as it has main()
+ */
+
+#include "headers.h"
+#include "structures.h"
+#include "prototypes.h"
+
+int writeAll(int fd, const char *buffer, int size) {
+	while (size > 0) {
+		int written = write(fd, buffer, size);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return -1;
+		buffer += written;
+		size -= written;
+	}
+	return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * uploadbench.c
+ *
+ * Measures throughput of PUT uploads from 1 KB up to 10 GB, received from a
+ * socket through receiveUpload(). Built with "make bench" in Debug; usage:
+ *     uploadbench [directory [largest size, e.g. 10G]]
+ * Files are written to the directory, the current one by default, and the
+ * largest size is 1G unless given, so a run doesn't need 10 GB of disk
+ */
+
+#include "headers.h"
+#include "structures.h"
+#include "prototypes.h"
+
+enum {
+	uploadChunkSize = 64 * 1024 /// default of the uploadChunkSize parameter
+};
+
+/*!
+ * Starts a process sending a body of given length, as a client would
+ * @param sockets Pair of connected sockets, the second one is written to
+ * @param length Length of the body
+ * @return Pid of the process
+ */
+static pid_t startSender(int sockets[2], long long length) {
+	pid_t pid = fork();
+	if (!pid) {
+		static char buffer[1 << 20];
+		memset(buffer, 'u', sizeof(buffer));
+		close(sockets[0]);
+		while (length > 0) {
+			int size = length < sizeof(buffer) ? length : sizeof(buffer);
+			if (writeAll(sockets[1], buffer, size))
+				_exit(1);
+			length -= size;
+		}
+		_exit(0);
+	}
+	close(sockets[1]);
+	return pid;
+}
+
+int main(int argc, char *argv[]) {
+	const long long sizes[] = { 1LL << 10, 1LL << 20, 100LL << 20, 1LL << 30,
+			10LL << 30 };
+	const char *directory = argc > 1 ? argv[1] : ".";
+	long long largest = 1LL << 30;
+	int s;
+
+	if (argc > 2) {
+		char *unit;
+		largest = strtoll(argv[2], &unit, 10);
+		if (*unit == 'K' || *unit == 'k')
+			largest <<= 10;
+		else if (*unit == 'M' || *unit == 'm')
+			largest <<= 20;
+		else if (*unit == 'G' || *unit == 'g')
+			largest <<= 30;
+	}
+	if (chdir(directory)) {
+		printf("Couldn't enter %s\n", directory);
+		return 1;
+	}
+
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]) && sizes[s] <= largest;
+			++s) {
+		/* small uploads are repeated, so the time is measurable */
+		int rounds = sizes[s] < (1 << 20) ? 1000 : sizes[s] < (100 << 20) ? 20
+				: 1;
+		long long elapsed = 0;
+		int i;
+		for (i = 0; i < rounds; ++i) {
+			int sockets[2];
+			socketpair(AF_UNIX, SOCK_STREAM, 0, sockets);
+			pid_t sender = startSender(sockets, sizes[s]);
+
+			BodyReader body;
+			bodyInit(&body, sockets[0], sizes[s]);
+			long long start = nowMicros();
+			enum codes status = receiveUpload("uploadbench.bin", &body,
+					uploadChunkSize);
+			elapsed += nowMicros() - start;
+
+			close(sockets[0]);
+			waitpid(sender, 0, 0);
+			unlink("uploadbench.bin");
+			if (status != created && status != noContent) {
+				printf("Upload of %lld bytes failed\n", sizes[s]);
+				return 1;
+			}
+		}
+		printf("%8lld KB: %8.1f ms/upload, %8.1f MB/s\n", sizes[s] >> 10,
+				elapsed / 1000.0 / rounds, (double) sizes[s] * rounds
+						/ elapsed);
+	}
+	return 0;
+}
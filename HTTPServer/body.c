@@ -0,0 +1,216 @@
+#include "headers.h"
+#include "structures.h"
+#include "prototypes.h"
+
+/*!
+ * Finds a header in a request
+ * @param requestList List of lines of the request
+ * @param name Name of the header without colon, compared case-insensitively
+ * @return Value of the header without leading whitespace, 0 if not found
+ */
+const char* findHeader(struct bstrList *requestList, const char *name) {
+	int len = strlen(name);
+	int i;
+	for (i = 1; i < requestList->qty; ++i) {
+		const char *line = (const char*) requestList->entry[i]->data;
+		if (requestList->entry[i]->slen > len && line[len] == ':'
+				&& !strncasecmp(line, name, len)) {
+			line += len + 1;
+			while (*line == ' ' || *line == '\t')
+				++line;
+			return line;
+		}
+	}
+	return 0;
+}
+
+/*!
+ * Checks whether a value of Host header is a plain host[:port], so that it
+ * can be copied into response headers
+ * @param host Value of the header
+ * @return true if the value holds only characters of a host name, an IPv4
+ * or bracketed IPv6 address and a port
+ */
+int isValidHost(const char *host) {
+	int len = strspn(host, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"
+			"0123456789.-:[]");
+	return len > 0 && len <= 255 && !host[len];
+}
+
+/*!
+ * Gets length of the request body
+ * @param requestList List of lines of the request
+ * @return Value of Content-Length header, -1 if missing or malformed
+ */
+long long getContentLength(struct bstrList *requestList) {
+	const char *value = findHeader(requestList, "Content-Length");
+	if (!value || !isdigit(*value))
+		return -1;
+	char *end;
+	long long length = strtoll(value, &end, 10);
+	return *end ? -1 : length;
+}
+
+/*!
+ * Prepares reading of a request body from a socket
+ * @param body Reader to initialize
+ * @param sockd Socket the request came from
+ * @param length Length of the body
+ */
+void bodyInit(BodyReader *body, int sockd, long long length) {
+	memset(body, 0, sizeof(BodyReader));
+	body->sockd = sockd;
+	body->remaining = length;
+}
+
+/*!
+ * Prepares reading of a request body, framed either by Content-Length or by
+ * chunked transfer coding, which takes precedence
+ * @param body Reader to initialize
+ * @param sockd Socket the request came from
+ * @param requestList List of lines of the request
+ * @return 0 on success, -1 if the length of the body can't be determined
+ */
+int bodyInitFromRequest(BodyReader *body, int sockd,
+		struct bstrList *requestList) {
+	const char *coding = findHeader(requestList, "Transfer-Encoding");
+	if (coding) {
+		if (strcasecmp(coding, "chunked"))
+			return -1;
+		bodyInit(body, sockd, 0);
+		body->chunked = true;
+		body->state = chunkStateSize;
+		return 0;
+	}
+
+	long long length = getContentLength(requestList);
+	if (length < 0)
+		return -1;
+	bodyInit(body, sockd, length);
+	return 0;
+}
+
+/*!
+ * Decodes received part of a chunked body in place, dropping chunk sizes,
+ * extensions and trailers. Any part of the framing may be split between calls
+ * @param body Reader
+ * @param data Received bytes, overwritten with the decoded body
+ * @param len Number of received bytes
+ * @return Number of decoded bytes at the start of data, -1 if malformed
+ */
+static int chunkDecode(BodyReader *body, char *data, int len) {
+	int read = 0, written = 0;
+	while (read < len && body->state != chunkStateDone) {
+		char c = data[read];
+		int value;
+
+		switch (body->state) {
+		case chunkStateSize:
+			value = hexValue(c);
+			if (value >= 0) {
+				/* a size that doesn't fit in long long is malformed */
+				if (body->remaining > (LLONG_MAX - 15) / 16)
+					return -1;
+				body->remaining = body->remaining * 16 + value;
+				++body->digits;
+			} else if (!body->digits)
+				return -1;
+			else if (c == ';' || c == ' ' || c == '\t')
+				body->state = chunkStateExtension;
+			else if (c == '\n')
+				body->state = body->remaining ? chunkStateData
+						: chunkStateTrailer;
+			else if (c != '\r')
+				return -1;
+			++read;
+			break;
+
+		case chunkStateExtension:
+			if (c == '\n')
+				body->state = body->remaining ? chunkStateData
+						: chunkStateTrailer;
+			++read;
+			break;
+
+		case chunkStateData:
+			/* compared as long long, a huge chunk must not wrap to 0 */
+			value = body->remaining < len - read ? (int) body->remaining
+					: len - read;
+			memmove(&data[written], &data[read], value);
+			read += value;
+			written += value;
+			body->remaining -= value;
+			if (!body->remaining)
+				body->state = chunkStateDataEnd;
+			break;
+
+		case chunkStateDataEnd:
+			if (c == '\n') {
+				body->state = chunkStateSize;
+				body->digits = 0;
+			} else if (c != '\r')
+				return -1;
+			++read;
+			break;
+
+		case chunkStateTrailer:
+			if (c == '\n')
+				body->state = chunkStateDone;
+			else if (c != '\r')
+				body->state = chunkStateTrailerLine;
+			++read;
+			break;
+
+		case chunkStateTrailerLine:
+			if (c == '\n')
+				body->state = chunkStateTrailer;
+			++read;
+			break;
+
+		default:
+			break;
+		}
+	}
+	return written;
+}
+
+/*!
+ * Reads next piece of a request body. Never reads past a body framed by
+ * Content-Length
+ * @param body Reader
+ * @param buffer Buffer for data
+ * @param size Size of the buffer
+ * @return Number of bytes read, 0 at the end of body, -1 if the connection
+ * failed or was closed before the whole body arrived
+ */
+int bodyRead(BodyReader *body, char *buffer, int size) {
+	int received;
+	if (body->chunked) {
+		/* the connection ends with the response, so reading past the last
+		 * chunk is harmless */
+		while (body->state != chunkStateDone) {
+			do
+				received = read(body->sockd, buffer, size);
+			while (received < 0 && errno == EINTR);
+			if (received <= 0)
+				return -1;
+			received = chunkDecode(body, buffer, received);
+			if (received)
+				return received;
+		}
+		return 0;
+	}
+
+	if (body->remaining <= 0)
+		return 0;
+	if (size > body->remaining)
+		size = body->remaining;
+
+	do
+		received = read(body->sockd, buffer, size);
+	while (received < 0 && errno == EINTR);
+	if (received <= 0)
+		return -1;
+	body->remaining -= received;
+	return received;
+}
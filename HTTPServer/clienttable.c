@@ -0,0 +1,156 @@
+#include "headers.h"
+#include "structures.h"
+#include "prototypes.h"
+
+/*!
+ * Packs index of the first free slot and a tag into the head of free list.
+ * The tag changes with every update, so a compare-and-swap based on a head
+ * read before other processes took and returned the same slot fails (ABA)
+ * @param tag Tag of the previous head
+ * @param index Index of the first free slot, -1 if none
+ * @return New head
+ */
+static unsigned long long clientTableHead(unsigned long long tag, int index) {
+	return ((tag >> 32) + 1) << 32 | (unsigned int) index;
+}
+
+/*!
+ * Gives the position where a process id is looked for first in the hash
+ * @param table Table of clients
+ * @param pid Process id
+ * @return Position in the hash
+ */
+static unsigned int clientTableBucket(const ClientTable *table, int pid) {
+	return ((unsigned int) pid * 2654435761u) & table->byPidMask;
+}
+
+/*!
+ * Creates a table of connected clients in shared memory, so that it is seen
+ * by every process forked afterwards. All slots start on the free list
+ * @param size Number of slots
+ * @return Pointer to the table, 0 if shared memory could not be created
+ */
+ClientTable* clientTableCreate(int size) {
+	/* the hash stays at most half full, so probe sequences are short */
+	unsigned int hashSize = 1;
+	while (hashSize < 2 * size)
+		hashSize *= 2;
+	size_t length = sizeof(ClientTable) + size * sizeof(ClientInfo) + hashSize
+			* sizeof(int);
+	ClientTable *table = (ClientTable*) sharedAlloc(length);
+	if (!table)
+		return 0;
+	int i;
+	for (i = 0; i < size; ++i) {
+		table->slot[i].status = empty;
+		table->slot[i].next = i + 1 < size ? i + 1 : -1;
+	}
+	table->freeHead = clientTableHead(0, size ? 0 : -1);
+	table->size = size;
+	table->byPid = (int*) &table->slot[size];
+	table->byPidMask = hashSize - 1;
+	return table;
+}
+
+/*!
+ * Takes a free slot off the free list, in constant time and without locks
+ * @param table Table of clients
+ * @return Index of the slot, now in state new, or -1 if all slots are used
+ */
+int clientSlotAcquire(ClientTable *table) {
+	unsigned long long head, next;
+	int index;
+	do {
+		head = table->freeHead;
+		index = (int) (unsigned int) head;
+		if (index < 0)
+			return -1;
+		next = clientTableHead(head, table->slot[index].next);
+	} while (!__sync_bool_compare_and_swap(&table->freeHead, head, next));
+
+	table->slot[index].status = new;
+	__sync_add_and_fetch(&table->used, 1);
+	return index;
+}
+
+/*!
+ * Returns a slot to the free list, in constant time and without locks. The
+ * slot must not be in the hash of process ids; a slot given to a process is
+ * released with clientSlotReleasePid() once the process is reaped
+ * @param table Table of clients
+ * @param index Index of the slot
+ */
+void clientSlotRelease(ClientTable *table, int index) {
+	ClientInfo *slot = &table->slot[index];
+	__sync_lock_test_and_set(&slot->status, empty);
+	__sync_sub_and_fetch(&table->used, 1);
+
+	unsigned long long head;
+	do {
+		head = table->freeHead;
+		slot->next = (int) (unsigned int) head;
+	} while (!__sync_bool_compare_and_swap(&table->freeHead, head,
+			clientTableHead(head, index)));
+}
+
+/*!
+ * Changes state of a slot atomically
+ * @param table Table of clients
+ * @param index Index of the slot
+ * @param from Expected state
+ * @param to New state
+ * @return true if the slot was in the expected state and was changed
+ */
+int clientSlotSetStatus(ClientTable *table, int index, enum ClientStatus from,
+		enum ClientStatus to) {
+	return __sync_bool_compare_and_swap(&table->slot[index].status, from, to);
+}
+
+/*!
+ * Records the process serving a slot, so that the slot is found in constant
+ * time when the process is reaped. Only the process which forks the clients
+ * may call this
+ * @param table Table of clients
+ * @param index Index of the slot
+ * @param pid Process serving the client
+ */
+void clientSlotAssign(ClientTable *table, int index, int pid) {
+	table->slot[index].procid = pid;
+	unsigned int i = clientTableBucket(table, pid);
+	while (table->byPid[i])
+		i = (i + 1) & table->byPidMask;
+	table->byPid[i] = index + 1;
+}
+
+/*!
+ * Releases the slot of a process which ended. Slots are freed only once
+ * their process is gone, so one killed at any point never leaks its slot.
+ * Only the process which forks the clients may call this
+ * @param table Table of clients
+ * @param pid Process which ended
+ * @return true if a slot was released, false if the process had none
+ */
+int clientSlotReleasePid(ClientTable *table, int pid) {
+	unsigned int mask = table->byPidMask;
+	unsigned int i = clientTableBucket(table, pid);
+	while (table->byPid[i] && table->slot[table->byPid[i] - 1].procid != pid)
+		i = (i + 1) & mask;
+	if (!table->byPid[i])
+		return false;
+	int index = table->byPid[i] - 1;
+
+	/* close the gap, moving back entries which could not be placed in it */
+	unsigned int gap = i;
+	for (i = (i + 1) & mask; table->byPid[i]; i = (i + 1) & mask) {
+		unsigned int home = clientTableBucket(table,
+				table->slot[table->byPid[i] - 1].procid);
+		if (((i - home) & mask) >= ((i - gap) & mask)) {
+			table->byPid[gap] = table->byPid[i];
+			gap = i;
+		}
+	}
+	table->byPid[gap] = 0;
+
+	clientSlotRelease(table, index);
+	return true;
+}
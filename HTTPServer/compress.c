@@ -0,0 +1,388 @@
+#include "headers.h"
+#include "structures.h"
+#include "prototypes.h"
+
+/* prefixes of types from mime.h worth compressing; the rest is either
+ * compressed already (images, audio, video, archives) or unknown */
+static const char *compressibleTypes[] = { "text/", "application/xml",
+		"application/x-javascript", "application/postscript",
+		"application/msword", "application/vnd.ms-excel",
+		"application/vnd.ms-powerpoint", "application/vnd.mif",
+		"application/smil", "application/x-chess-pgn", "application/x-csh",
+		"application/x-dvi", "application/x-latex", "application/x-sh",
+		"application/x-shar", "application/x-tar", "application/x-tcl",
+		"application/x-tex", "application/x-texinfo", "application/x-troff",
+		"application/x-ustar", "application/x-wais-source", "image/bmp",
+		"image/x-portable-", "image/x-rgb", "image/x-xbitmap",
+		"image/x-xpixmap", "image/x-xwindowdump", "model/", "chemical/",
+		"x-world/x-vrml" };
+static const int compressibleTypeCount = sizeof(compressibleTypes)
+		/ sizeof(compressibleTypes[0]);
+
+/* files are compressed in pieces of this size */
+static const int compressChunkSize = 64 * 1024;
+
+/* a temporary file not written to for this long, in seconds, was left by a
+ * process which died while compressing */
+static const int compressStaleTime = 10;
+
+/* settings given to compressInit() */
+static Stats *compressStats;
+static int cacheFd = -1;
+static int level;
+static off_t minLength;
+static off_t maxLength;
+static long long cacheSize;
+static unsigned long long cacheSeed;
+
+/*!
+ * Continues FNV-1a hash of a string
+ * @param hash Hash of the preceding data
+ * @param data String to add
+ * @return Hash including the string
+ */
+static unsigned long long hashString(unsigned long long hash, const char *data) {
+	while (*data) {
+		hash ^= (unsigned char) *data++;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/*!
+ * Sets up compression of responses. Must be called before forking the
+ * processes which compress
+ * @param stats Statistics to update, may be 0
+ * @param directory Directory compressed files are cached in, created if
+ * missing; it must lie outside of the server directory, which is public.
+ * Compression is off if the directory can't be used
+ * @param compressionLevel zlib compression level, 1 (fastest) to 9 (best)
+ * @param minimumLength Files shorter than this are sent as they are
+ * @param maximumLength Files longer than this are compressed while they are
+ * sent, without caching
+ * @param budget Largest total size of cached files; the least recently used
+ * ones are removed to stay below it
+ * @return 0 on success, -1 if the cache directory can't be used
+ */
+int compressInit(Stats *stats, const char *directory, int compressionLevel,
+		off_t minimumLength, off_t maximumLength, long long budget) {
+	compressStats = stats;
+	level = compressionLevel;
+	minLength = minimumLength;
+	maxLength = maximumLength;
+	cacheSize = budget;
+	if (cacheFd >= 0)
+		close(cacheFd);
+
+	/* servers run from different directories share no entries */
+	char cwd[PATH_MAX];
+	cacheSeed = hashString(14695981039346656037ULL, getcwd(cwd, sizeof(cwd))
+			? cwd : "");
+	/* nobody else may place files in the cache; the directory is used
+	 * through its descriptor only, so it can't be swapped for a symlink */
+	struct stat attrib;
+	if (mkdir(directory, 0700) && errno != EEXIST)
+		cacheFd = -1;
+	else
+		cacheFd = open(directory, O_RDONLY | O_DIRECTORY | O_NOFOLLOW
+				| O_CLOEXEC);
+	if (cacheFd >= 0 && (fstat(cacheFd, &attrib) || attrib.st_uid
+			!= geteuid() || (attrib.st_mode & 022))) {
+		close(cacheFd);
+		cacheFd = -1;
+	}
+	return cacheFd >= 0 ? 0 : -1;
+}
+
+/*!
+ * Checks whether files of a type are worth compressing
+ * @param mimeType Type of the file, as in mime.h
+ * @return true if the type is in the policy table
+ */
+int isCompressibleType(const char *mimeType) {
+	int i;
+	for (i = 0; i < compressibleTypeCount; ++i)
+		if (!strncmp(mimeType, compressibleTypes[i], strlen(
+				compressibleTypes[i])))
+			return true;
+	return false;
+}
+
+/*!
+ * Gets CPU time used by the process
+ * @return CPU time in microseconds
+ */
+static long long cpuMicros() {
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/*!
+ * Compresses a file with gzip
+ * @param in File to compress, read from the beginning
+ * @param out File or socket to write to
+ * @param output Function writing all of given data to out, like fsWrite()
+ * @return Length of the compressed data, -1 on failure
+ */
+static long long gzipFile(int in, int out, int (*output)(int, const char*,
+		int)) {
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	/* 16 added to window bits asks for gzip header and trailer */
+	if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8,
+			Z_DEFAULT_STRATEGY) != Z_OK)
+		return -1;
+
+	long long start = cpuMicros();
+	unsigned char *input = (unsigned char*) malloc(2 * compressChunkSize);
+	unsigned char *compressed = input + compressChunkSize;
+	long long offset = 0, written = 0;
+	int flush = Z_NO_FLUSH, status = Z_OK;
+	while (status != Z_STREAM_END) {
+		if (!stream.avail_in && flush == Z_NO_FLUSH) {
+			long size = pread(in, input, compressChunkSize, offset);
+			if (size < 0 && errno == EINTR)
+				continue;
+			if (size < 0)
+				break;
+			offset += size;
+			stream.next_in = input;
+			stream.avail_in = size;
+			if (!size)
+				flush = Z_FINISH;
+		}
+		stream.next_out = compressed;
+		stream.avail_out = compressChunkSize;
+		status = deflate(&stream, flush);
+		if (status == Z_STREAM_ERROR)
+			break;
+		int size = compressChunkSize - stream.avail_out;
+		if (size && output(out, (const char*) compressed, size))
+			break;
+		written += size;
+	}
+	deflateEnd(&stream);
+	free(input);
+
+	if (compressStats) {
+		__sync_fetch_and_add(&compressStats->compressions, 1);
+		__sync_fetch_and_add(&compressStats->compressCpu, cpuMicros() - start);
+	}
+	if (status != Z_STREAM_END)
+		return -1;
+	if (compressStats) {
+		__sync_fetch_and_add(&compressStats->compressedIn, offset);
+		__sync_fetch_and_add(&compressStats->compressedOut, written);
+	}
+	return written;
+}
+
+/* file in the cache, as seen by compressEvict() */
+typedef struct CacheEntry {
+	char name[32];
+	time_t used;
+	off_t size;
+} CacheEntry;
+
+/*!
+ * Orders cache entries from the least recently used
+ * @param a First entry
+ * @param b Second entry
+ * @return Negative, zero or positive number, as for qsort()
+ */
+static int compareCacheEntries(const void *a, const void *b) {
+	time_t usedA = ((const CacheEntry*) a)->used;
+	time_t usedB = ((const CacheEntry*) b)->used;
+	return usedA < usedB ? -1 : usedA > usedB;
+}
+
+/*!
+ * Removes the least recently used files from the cache until it fits its
+ * budget. Access time of an entry is updated on every hit
+ */
+static void compressEvict() {
+	/* a descriptor of its own, as the position in a shared one would be
+	 * moved by other processes */
+	int dirFd = openat(cacheFd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	DIR *dir = dirFd >= 0 ? fdopendir(dirFd) : 0;
+	if (!dir) {
+		if (dirFd >= 0)
+			close(dirFd);
+		return;
+	}
+
+	CacheEntry *entries = 0;
+	int count = 0, capacity = 0;
+	long long total = 0;
+	struct dirent *dirEntry;
+	while ((dirEntry = readdir(dir))) {
+		struct stat attrib;
+		int len = strlen(dirEntry->d_name);
+		if (len < 4 || len >= sizeof(entries->name) || strcmp(
+				&dirEntry->d_name[len - 3], ".gz") || fstatat(cacheFd,
+				dirEntry->d_name, &attrib, AT_SYMLINK_NOFOLLOW)
+				|| !S_ISREG(attrib.st_mode))
+			continue;
+		if (count == capacity) {
+			capacity = capacity ? 2 * capacity : 64;
+			entries = (CacheEntry*) realloc(entries, capacity
+					* sizeof(CacheEntry));
+		}
+		strcpy(entries[count].name, dirEntry->d_name);
+		entries[count].used = attrib.st_atime;
+		entries[count].size = attrib.st_size;
+		total += attrib.st_size;
+		++count;
+	}
+	closedir(dir);
+
+	if (total > cacheSize) {
+		qsort(entries, count, sizeof(CacheEntry), compareCacheEntries);
+		int i;
+		for (i = 0; i < count && total > cacheSize; ++i)
+			if (!unlinkat(cacheFd, entries[i].name, 0) || errno == ENOENT)
+				total -= entries[i].size;
+	}
+	free(entries);
+}
+
+/*!
+ * Compresses a file into the cache, replacing an older copy. Only one
+ * process compresses a file at a time, others send it as it is meanwhile
+ * @param fd Descriptor of the file
+ * @param name Name of the copy in the cache directory
+ * @param original Attributes of the file, its modification time is given to
+ * the copy
+ * @param[out] attrib Will contain attributes of the copy
+ * @return Descriptor of the copy, -1 on failure or if another process is
+ * compressing the file
+ */
+static int compressToCache(int fd, const char *name,
+		const struct stat *original, struct stat *attrib) {
+	/* compress to a temporary file, renamed into place when complete; its
+	 * name is fixed, so that it tells others the file is being compressed */
+	char temp[strlen(name) + 8];
+	sprintf(temp, "%s.tmp", name);
+	int cached = openat(cacheFd, temp, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW
+			| O_CLOEXEC, 0600);
+	struct stat tempAttrib;
+	if (cached < 0 && errno == EEXIST && !fstatat(cacheFd, temp, &tempAttrib,
+			AT_SYMLINK_NOFOLLOW) && time(0) - tempAttrib.st_mtime
+			> compressStaleTime && !unlinkat(cacheFd, temp, 0))
+		cached = openat(cacheFd, temp, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW
+				| O_CLOEXEC, 0600);
+	if (cached < 0)
+		return -1;
+	long long length = gzipFile(fd, cached, fsWrite);
+
+	/* a file changed meanwhile may have been read inconsistently; the copy
+	 * counts as used now, for the eviction */
+	struct stat current;
+	struct timespec times[2] = { { 0, UTIME_NOW }, original->st_mtim };
+	if (length < 0 || fstat(fd, &current) || current.st_mtim.tv_sec
+			!= original->st_mtim.tv_sec || current.st_mtim.tv_nsec
+			!= original->st_mtim.tv_nsec || futimens(cached, times) || fstat(
+			cached, attrib) || renameat(cacheFd, temp, cacheFd, name)) {
+		unlinkat(cacheFd, temp, 0);
+		close(cached);
+		return -1;
+	}
+	compressEvict();
+	return cached;
+}
+
+/*!
+ * Decides whether a file is sent compressed with gzip to a client
+ * @param acceptEncoding Value of Accept-Encoding header, may be 0
+ * @param mimeType Type of the file
+ * @param original Attributes of the file
+ * @return true if the file should be compressed
+ */
+static int shouldCompress(const char *acceptEncoding, const char *mimeType,
+		const struct stat *original) {
+	return cacheFd >= 0 && original->st_size >= minLength
+			&& isCompressibleType(mimeType) && acceptsEncoding(acceptEncoding,
+			"gzip");
+}
+
+/*!
+ * Opens a gzip-compressed copy of a file for a client accepting gzip. The
+ * copy is made on the first request and cached under a hash of the path,
+ * stamped with modification time of the file, so every version of a file is
+ * compressed once and a newer version replaces the older copy
+ * @param path Path of the file
+ * @param fd Descriptor of the file
+ * @param acceptEncoding Value of Accept-Encoding header, may be 0
+ * @param mimeType Type of the file
+ * @param original Attributes of the file
+ * @param[out] attrib Will contain attributes of the copy
+ * @return Descriptor of the copy, -1 if the file should be sent as it is or
+ * is too long to cache (see compressesWhileSending())
+ */
+int openCompressed(const char *path, int fd, const char *acceptEncoding,
+		const char *mimeType, const struct stat *original, struct stat *attrib) {
+	if (!shouldCompress(acceptEncoding, mimeType, original)
+			|| original->st_size > maxLength)
+		return -1;
+
+	char name[32];
+	sprintf(name, "%016llx.gz", hashString(cacheSeed, path));
+	int cached = openat(cacheFd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (cached >= 0 && (fstat(cached, attrib) || attrib->st_mtim.tv_sec
+			!= original->st_mtim.tv_sec || attrib->st_mtim.tv_nsec
+			!= original->st_mtim.tv_nsec)) {
+		close(cached);
+		cached = -1;
+	}
+	if (cached >= 0) {
+		/* mark the copy as used, keeping its modification time */
+		struct timespec times[2] = { { 0, UTIME_NOW }, { 0, UTIME_OMIT } };
+		futimens(cached, times);
+		if (compressStats)
+			__sync_fetch_and_add(&compressStats->compressHits, 1);
+	} else if ((cached = compressToCache(fd, name, original, attrib)) < 0)
+		return -1;
+
+	/* incompressible contents are cached as well, so they aren't tried again */
+	if (attrib->st_size >= original->st_size) {
+		close(cached);
+		return -1;
+	}
+	return cached;
+}
+
+/*!
+ * Checks whether a file is too long to be cached compressed, so that it is
+ * compressed while it is sent instead
+ * @param acceptEncoding Value of Accept-Encoding header, may be 0
+ * @param mimeType Type of the file
+ * @param original Attributes of the file
+ * @return true if the file should be sent with sendCompressed()
+ */
+int compressesWhileSending(const char *acceptEncoding, const char *mimeType,
+		const struct stat *original) {
+	return original->st_size > maxLength && shouldCompress(acceptEncoding,
+			mimeType, original);
+}
+
+/*!
+ * Sends a file compressed with gzip as it is read. The length of the
+ * response is not known in advance, so it ends when the connection closes
+ * @param sockd Output socket
+ * @param fd File to send
+ * @param headers Content type followed by other headers, as given to
+ * makeResponseHeader()
+ * @param httpVersion Version of HTTP used by the client
+ * @return 0 on success, -1 on error
+ */
+int sendCompressed(int sockd, int fd, const char *headers, int httpVersion) {
+	int headerSize;
+	char *header = makeResponseHeader(ok, headers, -1, &headerSize,
+			httpVersion);
+	int result = writeAll(sockd, header, headerSize);
+	free(header);
+	if (!result && gzipFile(fd, sockd, writeAll) < 0)
+		result = -1;
+	return result;
+}
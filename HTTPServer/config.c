@@ -0,0 +1,342 @@
+#include "headers.h"
+#include "structures.h"
+#include "prototypes.h"
+
+/* smallest block requested from the system for an arena */
+static const size_t arenaBlockSize = 4096;
+
+/* values of runtime parameters which are not configured */
+static const Params defaultParams = { .port = 6666, .backlog = 1024,
+		.maxConnections = 256, .serverTimeout = 5, .clientTimeout = 5,
+		.stopTimeout = 10, .requestBufferSize = 1024,
+		.maxRequestLength = 64 * 1024,
+		.uploadChunkSize = 64 * 1024, .maxFormLength = 64 * 1024 * 1024,
+		.maxFieldLength = 16 * 1024 * 1024, .maxFilePartLength = 8LL * 1024
+				* 1024 * 1024, .maxMultipartLength = 16LL * 1024 * 1024 * 1024,
+		.appendDurability = durabilityNone, .appendSyncInterval = 5,
+		.appendLogSize = 64, .authCacheSize = 64, .authCacheTTL = 60,
+		.maxRanges = 64, .rangeCoalesceGap = 256,
+		.gzipCacheDir = "/tmp/http-server-gzip", .gzipLevel = 6,
+		.gzipMinLength = 1024, .gzipMaxLength = 16 * 1024 * 1024,
+		.gzipCacheSize = 256 * 1024 * 1024 };
+
+/* runtime parameters with the values they accept */
+#define PARAM(name, type, min, max) { #name, type, offsetof(Params, name), \
+	min, max }
+static const ParamInfo paramInfo[] = {
+	PARAM(port, paramInt, 1, 65535),
+	PARAM(backlog, paramInt, 1, 1 << 20),
+	PARAM(maxConnections, paramInt, 1, 1 << 16),
+	PARAM(serverTimeout, paramInt, 1, 3600),
+	PARAM(clientTimeout, paramInt, 1, 3600),
+	PARAM(stopTimeout, paramInt, 0, 3600),
+	PARAM(requestBufferSize, paramInt, 64, 1 << 20),
+	PARAM(maxRequestLength, paramInt, 64, 1 << 26),
+	PARAM(uploadChunkSize, paramInt, 4096, 1 << 30),
+	PARAM(maxFormLength, paramLong, 0, 1LL << 62),
+	PARAM(maxFieldLength, paramLong, 0, 1LL << 62),
+	PARAM(maxFilePartLength, paramLong, 0, 1LL << 62),
+	PARAM(maxMultipartLength, paramLong, 0, 1LL << 62),
+	PARAM(appendDurability, paramDurability, 0, 0),
+	PARAM(appendSyncInterval, paramInt, 0, 60000),
+	PARAM(appendLogSize, paramInt, 1, 1 << 20),
+	PARAM(authCacheSize, paramInt, 1, 1 << 20),
+	PARAM(authCacheTTL, paramInt, 0, 1 << 30),
+	PARAM(maxRanges, paramInt, 1, 1024),
+	PARAM(rangeCoalesceGap, paramInt, 0, 1 << 30),
+	PARAM(gzipCacheDir, paramString, 0, 0),
+	PARAM(gzipLevel, paramInt, 1, 9),
+	PARAM(gzipMinLength, paramInt, 0, 1 << 30),
+	PARAM(gzipMaxLength, paramLong, 0, 1LL << 62),
+	PARAM(gzipCacheSize, paramLong, 0, 1LL << 62)
+};
+#undef PARAM
+static const int paramCount = sizeof(paramInfo) / sizeof(paramInfo[0]);
+
+/* names of durability levels, in order of enum Durability */
+static const char *durabilityNames[] = { "none", "interval", "request" };
+
+/*!
+ * Allocates memory from an arena. Memory is never freed one by one, only the
+ * whole arena at once
+ * @param arena Arena to allocate from
+ * @param size Number of bytes needed
+ * @return Pointer to the memory, aligned for any type, 0 if memory ran out
+ */
+void* arenaAlloc(Arena *arena, size_t size) {
+	const size_t align = sizeof(void*) * 2;
+	size = (size + align - 1) & ~(align - 1);
+
+	ArenaBlock *block = arena->block;
+	if (!block || block->used + size > block->size) {
+		size_t header = (sizeof(ArenaBlock) + align - 1) & ~(align - 1);
+		size_t total = header + size;
+		if (total < arenaBlockSize)
+			total = arenaBlockSize;
+		total = (total + arenaBlockSize - 1) & ~(arenaBlockSize - 1);
+
+		block = (ArenaBlock*) mmap(0, total, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (block == MAP_FAILED)
+			return 0;
+		block->next = arena->block;
+		block->size = total;
+		block->used = header;
+		arena->block = block;
+	}
+
+	void *result = (char*) block + block->used;
+	block->used += size;
+	return result;
+}
+
+/*!
+ * Copies a string into an arena
+ * @param arena Arena to allocate from
+ * @param str String to copy
+ * @param len Number of characters to copy
+ * @return Null-terminated copy of the string, 0 if memory ran out
+ */
+char* arenaStrndup(Arena *arena, const char *str, int len) {
+	char *copy = (char*) arenaAlloc(arena, len + 1);
+	if (!copy)
+		return 0;
+	memcpy(copy, str, len);
+	copy[len] = 0;
+	return copy;
+}
+
+/*!
+ * Makes all memory of an arena read-only. Pages which are never written stay
+ * shared between the server and every process forked from it
+ * @param arena Arena to seal
+ */
+void arenaSeal(Arena *arena) {
+	ArenaBlock *block;
+	for (block = arena->block; block; block = block->next)
+		mprotect(block, block->size, PROT_READ);
+}
+
+/*!
+ * Returns all memory of an arena to the system
+ * @param arena Arena to free
+ */
+void arenaFree(Arena *arena) {
+	ArenaBlock *block = arena->block;
+	while (block) {
+		ArenaBlock *next = block->next;
+		munmap(block, block->size);
+		block = next;
+	}
+}
+
+/*!
+ * Removes trailing new line characters
+ * @param line Line read from a file
+ * @return Length of the line without new line characters
+ */
+static int chomp(char *line) {
+	int len = strlen(line);
+	while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+		line[--len] = 0;
+	return len;
+}
+
+/*!
+ * Parses a number with optional k, M or G suffix
+ * @param value Text of the number
+ * @param[out] number Will contain the number
+ * @return 0 on success, -1 if the text is not a number
+ */
+static int parseSize(const char *value, long long *number) {
+	char *end;
+	errno = 0;
+	*number = strtoll(value, &end, 10);
+	if (end == value || errno)
+		return -1;
+	int shift = 0;
+	if (*end == 'k' || *end == 'K')
+		shift = 10;
+	else if (*end == 'm' || *end == 'M')
+		shift = 20;
+	else if (*end == 'g' || *end == 'G')
+		shift = 30;
+	if (shift && (*++end || *number > (1LL << (62 - shift)) || *number
+			< -(1LL << (62 - shift))))
+		return -1;
+	*number <<= shift;
+	return *end ? -1 : 0;
+}
+
+/*!
+ * Sets a runtime parameter
+ * @param params Parameters to change
+ * @param arena Arena for copies of strings
+ * @param line Text like "name=value"
+ * @return 0 on success, -1 if the parameter is unknown or the value invalid
+ */
+static int setParam(Params *params, Arena *arena, const char *line) {
+	const char *value = strchr(line, '=');
+	if (!value)
+		return -1;
+	int len = value++ - line;
+
+	int i;
+	for (i = 0; i < paramCount; ++i)
+		if (strlen(paramInfo[i].name) == len && !strncmp(line,
+				paramInfo[i].name, len))
+			break;
+	if (i == paramCount)
+		return -1;
+	const ParamInfo *info = &paramInfo[i];
+	char *field = (char*) params + info->offset;
+
+	long long number;
+	switch (info->type) {
+	case paramInt:
+	case paramLong:
+		if (parseSize(value, &number) || number < info->min || number
+				> info->max)
+			return -1;
+		if (info->type == paramInt)
+			*(int*) field = number;
+		else
+			*(long long*) field = number;
+		return 0;
+	case paramString:
+		*(const char**) field = arenaStrndup(arena, value, strlen(value));
+		return *(const char**) field ? 0 : -1;
+	case paramDurability:
+		for (i = 0; i < 3; ++i)
+			if (!strcmp(value, durabilityNames[i])) {
+				*(enum Durability*) field = (enum Durability) i;
+				return 0;
+			}
+		return -1;
+	}
+	return -1;
+}
+
+/*!
+ * Parses configuration file. Runtime parameters go first, one per line:
+ * name=value (numbers may end with k, M or G)
+ * Realms follow and look like:
+ * [name]
+ * login=%s
+ * pass=%s (plain text, or a crypt(3) hash such as $5$salt$... or $2b$...)
+ * uri=%s (one line per protected URI, may end with '*')
+ * Lines starting with '#' are comments. Parameters given on command line, in
+ * the same form, override those from the file. Everything is placed in one
+ * arena which is made read-only afterwards
+ * @param path Path to the configuration file
+ * @param generation Number of the snapshot
+ * @param argc Number of command line arguments
+ * @param argv Command line arguments, the first one is skipped
+ * @param[out] errors Will contain the number of problems with the file: 1 if
+ * it can't be read, otherwise the number of invalid lines, which are skipped
+ * @return Parsed configuration, with no realms if the file can't be read, or
+ * 0 if memory ran out
+ */
+Config* loadConfig(const char *path, int generation, int argc, char **argv,
+		int *errors) {
+	Arena arena = { 0 };
+	FILE *file = 0;
+	*errors = 0;
+	Config *config = (Config*) arenaAlloc(&arena, sizeof(Config));
+	if (!config)
+		goto OutOfMemory;
+	config->realm = 0;
+	config->realmCount = 0;
+	config->realmTrie = realmTrieCreate(&arena);
+	if (!config->realmTrie)
+		goto OutOfMemory;
+	config->params = defaultParams;
+	config->generation = generation;
+
+	file = fopen(path, "r");
+	if (!file) {
+		printf("Couldn't read %s\n", path);
+		++*errors;
+	} else {
+		char line[1024];
+
+		/* count realms first, so that exactly as many are allocated */
+		int count = 0;
+		while (fgets(line, sizeof(line), file))
+			if (line[0] == '[')
+				++count;
+		config->realm = (Realm*) arenaAlloc(&arena, count * sizeof(Realm));
+		if (!config->realm)
+			goto OutOfMemory;
+		rewind(file);
+
+		Realm *realm = 0;
+		while (fgets(line, sizeof(line), file)) {
+			int len = chomp(line);
+			/* line starting new realm is like: [%s] */
+			if (line[0] == '[' && len > 1 && line[len - 1] == ']') {
+				if (config->realmCount == count)
+					break;
+				realm = &config->realm[config->realmCount++];
+				realm->name = arenaStrndup(&arena, &line[1], len - 2);
+				if (!realm->name)
+					goto OutOfMemory;
+				realm->login = "";
+				realm->pass = "";
+			} else if (!len || line[0] == '#')
+				continue;
+			else if (!realm) {
+				if (setParam(&config->params, &arena, line)) {
+					printf("Invalid parameter in %s: %s\n", path, line);
+					++*errors;
+				}
+			}
+			/* line with login is like: login=%s */
+			else if (!(strncmp(line, "login=", 6))) {
+				if (!(realm->login = arenaStrndup(&arena, &line[6], len - 6)))
+					goto OutOfMemory;
+			}
+			/* line with password is like: pass=%s */
+			else if (!(strncmp(line, "pass=", 5))) {
+				if (!(realm->pass = arenaStrndup(&arena, &line[5], len - 5)))
+					goto OutOfMemory;
+			}
+			/* lines with URIs are like: uri=%s */
+			else if (!(strncmp(line, "uri=", 4))) {
+				if (realmTrieInsert(&arena, config->realmTrie, &line[4],
+						config->realmCount - 1))
+					goto OutOfMemory;
+			} else {
+				printf("Invalid line in %s: %s\n", path, line);
+				++*errors;
+			}
+		}
+		fclose(file);
+	}
+
+	int i;
+	for (i = 1; i < argc; ++i)
+		if (setParam(&config->params, &arena, argv[i]))
+			printf("Invalid parameter: %s\n", argv[i]);
+	fflush(stdout);
+
+	config->arena = arena;
+	arenaSeal(&config->arena);
+	return config;
+
+	OutOfMemory: if (file)
+		fclose(file);
+	arenaFree(&arena);
+	printf("Not enough memory for configuration\n");
+	fflush(stdout);
+	return 0;
+}
+
+/*!
+ * Frees a configuration returned by loadConfig()
+ * @param config Configuration to free
+ */
+void freeConfig(Config *config) {
+	Arena arena = config->arena;
+	arenaFree(&arena);
+}
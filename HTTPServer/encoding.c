@@ -0,0 +1,75 @@
+#include "headers.h"
+#include "structures.h"
+#include "prototypes.h"
+
+/* content codings of precompressed files, in order of preference */
+static const char *sidecarCodings[] = { "br", "gzip" };
+static const char *sidecarSuffixes[] = { ".br", ".gz" };
+static const int sidecarCount = 2;
+
+/*!
+ * Checks whether a client accepts a content coding
+ * @param acceptEncoding Value of Accept-Encoding header, may be 0
+ * @param coding Name of the coding, e.g. "gzip"
+ * @return true if the coding is listed, or matched by "*", with nonzero q
+ */
+int acceptsEncoding(const char *acceptEncoding, const char *coding) {
+	if (!acceptEncoding)
+		return false;
+	int len = strlen(coding);
+	int wildcard = false;
+	const char *token = acceptEncoding;
+	while (*token) {
+		token += strspn(token, " \t,");
+		int tokenLength = strcspn(token, " \t;,");
+		if (!tokenLength)
+			break;
+
+		/* quality of the coding, 1 unless given */
+		double quality = 1;
+		const char *params = token + tokenLength;
+		const char *end = params + strcspn(params, ",");
+		const char *q = strstr(params, "q=");
+		if (q && q < end)
+			quality = atof(q + 2);
+
+		if (tokenLength == len && !strncasecmp(token, coding, len))
+			return quality > 0;
+		if (tokenLength == 1 && *token == '*')
+			wildcard = quality > 0;
+		token = end;
+	}
+	return wildcard;
+}
+
+/*!
+ * Opens a precompressed copy of a file, e.g. "app.js.gz" next to "app.js",
+ * if the client accepts its coding and the copy is not older than the file.
+ * A missing copy costs a single failed openat()
+ * @param path Path of the file
+ * @param acceptEncoding Value of Accept-Encoding header, may be 0
+ * @param original Attributes of the file
+ * @param[out] attrib Will contain attributes of the copy
+ * @param[out] coding Will contain name of the coding of the copy
+ * @return Descriptor of the copy, -1 if there is none to send
+ */
+int openSidecar(const char *path, const char *acceptEncoding,
+		const struct stat *original, struct stat *attrib, const char **coding) {
+	int i;
+	for (i = 0; i < sidecarCount; ++i) {
+		if (!acceptsEncoding(acceptEncoding, sidecarCodings[i]))
+			continue;
+		char sidecar[strlen(path) + 4];
+		sprintf(sidecar, "%s%s", path, sidecarSuffixes[i]);
+		int fd = fsOpenat(sidecar, O_RDONLY, 0);
+		if (fd < 0)
+			continue;
+		if (!fstat(fd, attrib) && S_ISREG(attrib->st_mode) && attrib->st_mtime
+				>= original->st_mtime) {
+			*coding = sidecarCodings[i];
+			return fd;
+		}
+		close(fd);
+	}
+	return -1;
+}
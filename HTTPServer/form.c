@@ -0,0 +1,152 @@
+#include "headers.h"
+#include "structures.h"
+#include "prototypes.h"
+
+/*!
+ * Prepares a parser of application/x-www-form-urlencoded data
+ * @param parser Parser to initialize
+ * @param maxValueLength Longest value accepted, in decoded bytes
+ * @param maxLength Longest form accepted, in encoded bytes
+ * @param onField Function called with every decoded piece of a value
+ * @param context Pointer passed to onField
+ */
+void formInit(FormParser *parser, long maxValueLength, long maxLength,
+		FormCallback onField, void *context) {
+	memset(parser, 0, sizeof(FormParser));
+	parser->maxValueLength = maxValueLength;
+	parser->maxLength = maxLength;
+	parser->onField = onField;
+	parser->context = context;
+}
+
+/*!
+ * Converts a hexadecimal digit to its value
+ * @param c Character
+ * @return Value of the digit, -1 if it isn't a hexadecimal digit
+ */
+int hexValue(char c) {
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/*!
+ * Decodes one character of a form, keeping track of %XX escapes which may be
+ * split between chunks
+ * @param parser Parser
+ * @param c Encoded character
+ * @param decoded Will contain decoded character
+ * @return 1 if a character was decoded, 0 if more input is needed, -1 on error
+ */
+static int formDecode(FormParser *parser, char c, char *decoded) {
+	if (parser->escape) {
+		int value = hexValue(c);
+		if (value < 0)
+			return -1;
+		parser->escapeValue = parser->escapeValue * 16 + value;
+		if (++parser->escape < 3)
+			return 0;
+		parser->escape = 0;
+		*decoded = (char) parser->escapeValue;
+		return 1;
+	}
+	if (c == '%') {
+		parser->escape = 1;
+		parser->escapeValue = 0;
+		return 0;
+	}
+	*decoded = (c == '+') ? ' ' : c;
+	return 1;
+}
+
+/*!
+ * Ends current name=value pair
+ * @param parser Parser
+ */
+static void formEndField(FormParser *parser) {
+	parser->name[parser->nameLength] = 0;
+	if (parser->nameLength || parser->inValue)
+		parser->onField(parser->context, parser->name, "", 0, true);
+	parser->nameLength = 0;
+	parser->valueLength = 0;
+	parser->inValue = false;
+}
+
+/*!
+ * Parses next chunk of a form. Values are percent-decoded in place and passed
+ * to the callback as soon as they are known, so the form is never buffered
+ * @param parser Parser
+ * @param data Chunk of the form, overwritten with decoded values
+ * @param len Length of the chunk
+ * @return 0 on success, -1 if the form is malformed or exceeds the limits
+ */
+int formParse(FormParser *parser, char *data, int len) {
+	if (parser->error)
+		return -1;
+	parser->length += len;
+	if (parser->length > parser->maxLength)
+		return parser->error = -1;
+
+	int read, written = 0, start = 0;
+	for (read = 0; read < len; ++read) {
+		char c = data[read];
+		int decoded;
+
+		if (!parser->inValue) {
+			if (c == '=' && !parser->escape) {
+				parser->name[parser->nameLength] = 0;
+				parser->inValue = true;
+				start = written = read + 1;
+			} else if (c == '&' && !parser->escape)
+				formEndField(parser);
+			else {
+				decoded = formDecode(parser, c,
+						&parser->name[parser->nameLength]);
+				if (decoded < 0 || parser->nameLength + decoded
+						>= sizeof(parser->name))
+					return parser->error = -1;
+				parser->nameLength += decoded;
+			}
+			continue;
+		}
+
+		if (c == '&' && !parser->escape) {
+			parser->onField(parser->context, parser->name, &data[start],
+					written - start, true);
+			parser->nameLength = 0;
+			parser->valueLength = 0;
+			parser->inValue = false;
+			continue;
+		}
+
+		decoded = formDecode(parser, c, &data[written]);
+		if (decoded < 0)
+			return parser->error = -1;
+		written += decoded;
+		parser->valueLength += decoded;
+		if (parser->valueLength > parser->maxValueLength)
+			return parser->error = -1;
+	}
+
+	/* pass the part of a value decoded so far */
+	if (parser->inValue && written > start)
+		parser->onField(parser->context, parser->name, &data[start], written
+				- start, false);
+	return 0;
+}
+
+/*!
+ * Ends parsing, passing the last value to the callback
+ * @param parser Parser
+ * @return 0 on success, -1 if the form was malformed
+ */
+int formFinish(FormParser *parser) {
+	if (parser->error || parser->escape)
+		return -1;
+	formEndField(parser);
+	return 0;
+}
@@ -0,0 +1,100 @@
+#include "headers.h"
+#include "structures.h"
+#include "prototypes.h"
+
+/* statistics the operations are reported to */
+static Stats *fsStats;
+
+/*!
+ * Sets where filesystem operations are reported to. Must be called before
+ * forking the processes which should report
+ * @param stats Statistics to update, may be 0
+ */
+void fsInit(Stats *stats) {
+	fsStats = stats;
+}
+
+/*!
+ * Notes start of a filesystem operation
+ * @return Time the operation started at
+ */
+static long long fsBegin() {
+	if (fsStats) {
+		unsigned long pending = __sync_add_and_fetch(&fsStats->fsPending, 1);
+		unsigned long peak = fsStats->fsPendingPeak;
+		while (pending > peak && !__sync_bool_compare_and_swap(
+				&fsStats->fsPendingPeak, peak, pending))
+			peak = fsStats->fsPendingPeak;
+	}
+	return nowMicros();
+}
+
+/*!
+ * Notes end of a filesystem operation
+ * @param op Kind of the operation
+ * @param start Time returned by fsBegin()
+ */
+static void fsEnd(enum FsOp op, long long start) {
+	if (fsStats) {
+		histogramRecord(&fsStats->fsLatency[op], nowMicros() - start);
+		__sync_sub_and_fetch(&fsStats->fsPending, 1);
+	}
+}
+
+/*!
+ * Opens a file relative to the server directory. Files opened for reading
+ * are about to be sent whole, so the kernel is asked to read ahead
+ * aggressively, which shortens the stalls on a cold page cache
+ * @param path Path of the file
+ * @param flags Flags of openat()
+ * @param mode Permissions of a created file
+ * @return Descriptor of the file, -1 on failure
+ */
+int fsOpenat(const char *path, int flags, mode_t mode) {
+	long long start = fsBegin();
+	int fd = openat(AT_FDCWD, path, flags, mode);
+	fsEnd(fsOpOpen, start);
+	if (fd >= 0 && (flags & O_ACCMODE) == O_RDONLY)
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	return fd;
+}
+
+/*!
+ * Gets attributes of a file relative to the server directory
+ * @param path Path of the file
+ * @param attrib Will contain the attributes
+ * @return 0 on success, -1 on failure
+ */
+int fsStatat(const char *path, struct stat *attrib) {
+	long long start = fsBegin();
+	int result = fstatat(AT_FDCWD, path, attrib, 0);
+	fsEnd(fsOpStat, start);
+	return result;
+}
+
+/*!
+ * Lists a directory in alphabetical order
+ * @param path Path of the directory
+ * @param namelist Will contain entries of the directory, as from scandir()
+ * @return Number of entries, -1 on failure
+ */
+int fsScandir(const char *path, struct dirent ***namelist) {
+	long long start = fsBegin();
+	int count = scandir(path, namelist, 0, alphasort);
+	fsEnd(fsOpScan, start);
+	return count;
+}
+
+/*!
+ * Writes a whole buffer to a file
+ * @param fd The file
+ * @param buffer Data to write
+ * @param size Size of the data
+ * @return 0 on success, -1 on failure
+ */
+int fsWrite(int fd, const char *buffer, int size) {
+	long long start = fsBegin();
+	int result = writeAll(fd, buffer, size);
+	fsEnd(fsOpWrite, start);
+	return result;
+}
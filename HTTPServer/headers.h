@@ -8,27 +8,41 @@
 #ifndef headers_h
 #define headers_h
 
+#define _GNU_SOURCE
 #define _ATFILE_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <errno.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/param.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include <time.h>
+#include <sched.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
 #include <sys/wait.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/signalfd.h>
 #include <dirent.h>
+#include <crypt.h>
+#include <zlib.h>
 #include "bstring/bstrlib.h"
 
-void strptime(const char *, const char *, struct tm *);//warning prevention
-
 #endif /* headers_h */
@@ -0,0 +1,263 @@
+#include "headers.h"
+#include "structures.h"
+#include "prototypes.h"
+
+/*!
+ * Prepares a parser of multipart/form-data bodies
+ * @param parser Parser to initialize
+ * @param contentType Value of Content-Type header carrying the boundary
+ * @param maxFieldLength Longest plain field accepted
+ * @param maxPartLength Longest file accepted
+ * @param maxLength Longest body accepted
+ * @param onPart Function told about every part
+ * @param onData Function called with every piece of a part
+ * @param context Pointer passed to the callbacks
+ * @return 0 on success, -1 if the boundary is missing or invalid
+ */
+int multipartInit(MultipartParser *parser, const char *contentType,
+		long long maxFieldLength, long long maxPartLength,
+		long long maxLength, PartCallback onPart, FormCallback onData,
+		void *context) {
+	const char *boundary = strcasestr(contentType, "boundary=");
+	if (!boundary)
+		return -1;
+	boundary += 9;
+	int len;
+	if (*boundary == '"')
+		len = strcspn(++boundary, "\"");
+	else
+		len = strcspn(boundary, "; \t");
+	/* RFC 2046 limits boundaries to 70 characters */
+	if (!len || len > 70)
+		return -1;
+
+	parser->delimiterLength = len + 4;
+	memcpy(parser->delimiter, "\r\n--", 4);
+	memcpy(&parser->delimiter[4], boundary, len);
+
+	int i, m = parser->delimiterLength;
+	for (i = 0; i < 256; ++i)
+		parser->skip[i] = m;
+	for (i = 0; i < m - 1; ++i)
+		parser->skip[(unsigned char) parser->delimiter[i]] = m - 1 - i;
+
+	parser->state = multipartPreamble;
+	parser->headerLength = 0;
+	parser->length = 0;
+	parser->maxFieldLength = maxFieldLength;
+	parser->maxPartLength = maxPartLength;
+	parser->maxLength = maxLength;
+	parser->error = 0;
+	parser->onPart = onPart;
+	parser->onData = onData;
+	parser->context = context;
+
+	/* the first delimiter may start the body, without a line break before */
+	memcpy(parser->buffer, "\r\n", 2);
+	parser->carry = 2;
+	return 0;
+}
+
+/*!
+ * Gives the place where next input should be read to
+ * @param parser Parser
+ * @param[out] size Will contain free space at that place
+ * @return Pointer to the free part of the parser's buffer
+ */
+char* multipartBuffer(MultipartParser *parser, int *size) {
+	*size = sizeof(parser->buffer) - parser->carry;
+	return &parser->buffer[parser->carry];
+}
+
+/*!
+ * Finds the delimiter in data with Boyer-Moore-Horspool algorithm
+ * @param parser Parser holding the delimiter
+ * @param data Data to search
+ * @param len Length of the data
+ * @return Position of the delimiter, -1 if it is not there
+ */
+static int multipartSearch(const MultipartParser *parser, const char *data,
+		int len) {
+	int m = parser->delimiterLength;
+	char last = parser->delimiter[m - 1];
+	int i = 0;
+	while (i + m <= len) {
+		unsigned char c = data[i + m - 1];
+		if (c == last && !memcmp(&data[i], parser->delimiter, m - 1))
+			return i;
+		i += parser->skip[c];
+	}
+	return -1;
+}
+
+/*!
+ * Gets a parameter of Content-Disposition header
+ * @param header Value of the header
+ * @param param Name of the parameter followed by '='
+ * @param value Buffer for the value
+ * @param size Size of the buffer
+ * @return true if the parameter was found
+ */
+static int dispositionParam(const char *header, const char *param,
+		char *value, int size) {
+	int paramLength = strlen(param);
+	const char *token = strchr(header, ';');
+	while (token) {
+		token += strspn(token, "; \t");
+		if (!strncasecmp(token, param, paramLength)) {
+			token += paramLength;
+			int len;
+			if (*token == '"')
+				len = strcspn(++token, "\"\r");
+			else
+				len = strcspn(token, "; \t\r");
+			if (len >= size)
+				len = size - 1;
+			memcpy(value, token, len);
+			value[len] = 0;
+			return true;
+		}
+		token = strchr(token, ';');
+	}
+	return false;
+}
+
+/*!
+ * Starts a part whose headers were gathered
+ * @param parser Parser
+ * @return 0 on success, -1 if the callback refused the part
+ */
+static int multipartStartPart(MultipartParser *parser) {
+	parser->header[parser->headerLength] = 0;
+	parser->name[0] = 0;
+	parser->isFile = false;
+
+	const char *line = parser->header;
+	while (*line) {
+		if (!strncasecmp(line, "Content-Disposition:", 20)) {
+			dispositionParam(line, "name=", parser->name, sizeof(parser->name));
+			parser->isFile = dispositionParam(line, "filename=",
+					parser->filename, sizeof(parser->filename));
+		}
+		line += strcspn(line, "\n");
+		if (*line)
+			++line;
+	}
+
+	parser->partLength = 0;
+	parser->state = multipartBody;
+	return parser->onPart(parser->context, parser->name,
+			parser->isFile ? parser->filename : 0);
+}
+
+/*!
+ * Passes a piece of current part to the callback, checking limits
+ * @param parser Parser
+ * @param data Piece of the part
+ * @param len Length of the piece
+ * @param last Whether this is the last piece of the part
+ * @return 0 on success, -1 if the part is too long
+ */
+static int multipartData(MultipartParser *parser, const char *data, int len,
+		int last) {
+	parser->partLength += len;
+	if (parser->partLength > (parser->isFile ? parser->maxPartLength
+			: parser->maxFieldLength))
+		return -1;
+	if (len || last)
+		parser->onData(parser->context, parser->name, data, len, last);
+	return 0;
+}
+
+/*!
+ * Parses input read into the place given by multipartBuffer(). Contents of
+ * parts are passed to the callback as soon as they can't be a part of the
+ * delimiter, so only the tail which may start a delimiter is kept
+ * @param parser Parser
+ * @param len Number of bytes read
+ * @return 0 on success, -1 if the body is malformed or exceeds the limits
+ */
+int multipartParse(MultipartParser *parser, int len) {
+	if (parser->error)
+		return -1;
+	parser->length += len;
+	if (parser->length > parser->maxLength)
+		return parser->error = -1;
+
+	char *data = parser->buffer;
+	int total = parser->carry + len;
+	char *header;
+	int pos = 0, found, keep, n;
+	while (pos < total && !parser->error) {
+		switch (parser->state) {
+		case multipartPreamble:
+		case multipartBody:
+			found = multipartSearch(parser, &data[pos], total - pos);
+			if (found >= 0) {
+				if (parser->state == multipartBody && multipartData(parser,
+						&data[pos], found, true))
+					parser->error = -1;
+				pos += found + parser->delimiterLength;
+				parser->state = multipartDelimiter;
+				break;
+			}
+			/* the tail may be the beginning of a delimiter */
+			keep = parser->delimiterLength - 1;
+			if (keep > total - pos)
+				keep = total - pos;
+			if (parser->state == multipartBody && multipartData(parser,
+					&data[pos], total - pos - keep, false))
+				parser->error = -1;
+			pos = total - keep;
+			goto needMore;
+
+		case multipartDelimiter:
+			if (total - pos < 2)
+				goto needMore;
+			if (data[pos] == '-' && data[pos + 1] == '-') {
+				/* closing delimiter, the rest is an epilogue */
+				parser->state = multipartDone;
+				pos = total;
+			} else if (data[pos] == ' ' || data[pos] == '\t')
+				++pos;
+			else if (data[pos] == '\r' && data[pos + 1] == '\n') {
+				pos += 2;
+				parser->headerLength = 0;
+				parser->state = multipartHeaders;
+			} else
+				parser->error = -1;
+			break;
+
+		case multipartHeaders:
+			if (parser->headerLength == sizeof(parser->header) - 1) {
+				parser->error = -1;
+				break;
+			}
+			header = parser->header;
+			n = ++parser->headerLength;
+			header[n - 1] = data[pos++];
+			/* headers end with an empty line */
+			if (header[n - 1] == '\n' && ((n == 2 && header[0] == '\r') || (n
+					>= 4 && header[n - 3] == '\n')) && multipartStartPart(parser))
+				parser->error = -1;
+			break;
+
+		case multipartDone:
+			pos = total;
+			break;
+		}
+	}
+
+	needMore: parser->carry = total - pos;
+	memmove(parser->buffer, &data[pos], parser->carry);
+	return parser->error;
+}
+
+/*!
+ * Ends parsing
+ * @param parser Parser
+ * @return 0 if the body was complete, -1 otherwise
+ */
+int multipartFinish(MultipartParser *parser) {
+	return !parser->error && parser->state == multipartDone ? 0 : -1;
+}
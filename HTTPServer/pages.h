@@ -53,3 +53,14 @@ const char* notImplementedPage = "<html>\n"
 	"	</body>\n"
 	"</html>\n";
 
+
+const char* internalServerErrorPage = "<html>\n"
+	"	<head>\n"
+	"		<meta http-equiv=\"Content-Type\" content=\"text/html; charset=utf-8\"/>\n"
+	"		<meta name=\"Author\" content=\"Tomasz Zok, Krzystof Rosinski\"/>\n"
+	"	</head>\n"
+	"	\n"
+	"	<body>\n"
+	"	Error 500<br />Internal server error\n"
+	"	</body>\n"
+	"</html>\n";
@@ -8,12 +8,144 @@
 #ifndef PROTOTYPES_H_
 #define PROTOTYPES_H_
 
+/* from base64.c */
+
+int base64Decode(const char *, int, unsigned char *, int);
+int base64Encode(const unsigned char *, int, char *, int);
+
 /* from time.c */
 
 int compareDates(const struct tm *, const struct tm *);
 int fileModDate(const char *, struct tm *);
 void parseDate(const char *, struct tm *);
 int dateToStr(char *, const struct tm *);
+time_t parseHttpDate(const char *);
+int httpDateToStr(char *, int, time_t);
 void now(struct tm *);
+long long nowMicros();
+
+/* from appendlog.c */
+
+AppendLog* appendLogCreate(int, enum Durability, int, Stats *);
+void appendInit(AppendWriter *, AppendLog *, int);
+int appendWrite(AppendWriter *, const char *, int);
+int appendCommit(AppendWriter *);
+void appendAbort(AppendWriter *);
+off_t appendedLength(int);
+
+/* from authcache.c */
+
+AuthCache* authCacheCreate(int);
+int authCacheLookup(AuthCache *, const char *, int, int, int);
+void authCacheStore(AuthCache *, const char *, int, int, int, int);
+void authCacheClear(AuthCache *);
+
+/* from body.c */
+
+const char* findHeader(struct bstrList *, const char *);
+int isValidHost(const char *);
+long long getContentLength(struct bstrList *);
+void bodyInit(BodyReader *, int, long long);
+int bodyInitFromRequest(BodyReader *, int, struct bstrList *);
+int bodyRead(BodyReader *, char *, int);
+
+/* from clienttable.c */
+
+ClientTable* clientTableCreate(int);
+int clientSlotAcquire(ClientTable *);
+void clientSlotRelease(ClientTable *, int);
+int clientSlotSetStatus(ClientTable *, int, enum ClientStatus,
+		enum ClientStatus);
+void clientSlotAssign(ClientTable *, int, int);
+int clientSlotReleasePid(ClientTable *, int);
+
+/* from config.c */
+
+void* arenaAlloc(Arena *, size_t);
+char* arenaStrndup(Arena *, const char *, int);
+void arenaSeal(Arena *);
+void arenaFree(Arena *);
+Config* loadConfig(const char *, int, int, char **, int *);
+void freeConfig(Config *);
+
+/* from stats.c */
+
+Stats* statsCreate();
+void histogramRecord(Histogram *, long long);
+long long histogramPercentile(const Histogram *, int);
+void statsPrint(const Stats *);
+
+/* from compress.c */
+
+int compressInit(Stats *, const char *, int, off_t, off_t, long long);
+int isCompressibleType(const char *);
+int openCompressed(const char *, int, const char *, const char *,
+		const struct stat *, struct stat *);
+int compressesWhileSending(const char *, const char *, const struct stat *);
+int sendCompressed(int, int, const char *, int);
+
+/* from encoding.c */
+
+int acceptsEncoding(const char *, const char *);
+int openSidecar(const char *, const char *, const struct stat *,
+		struct stat *, const char **);
+
+/* from form.c */
+
+void formInit(FormParser *, long, long, FormCallback, void *);
+int hexValue(char);
+int formParse(FormParser *, char *, int);
+int formFinish(FormParser *);
+
+/* from fsops.c */
+
+void fsInit(Stats *);
+int fsOpenat(const char *, int, mode_t);
+int fsStatat(const char *, struct stat *);
+int fsScandir(const char *, struct dirent ***);
+int fsWrite(int, const char *, int);
+
+/* from multipart.c */
+
+int multipartInit(MultipartParser *, const char *, long long, long long,
+		long long, PartCallback, FormCallback, void *);
+char* multipartBuffer(MultipartParser *, int *);
+int multipartParse(MultipartParser *, int);
+int multipartFinish(MultipartParser *);
+
+/* from range.c */
+
+int parseRanges(const char *, off_t, ContentRange *, int);
+int coalesceRanges(ContentRange *, int, off_t);
+
+/* from realm.c */
+
+RealmNode* realmTrieCreate(Arena *);
+int realmTrieInsert(Arena *, RealmNode *, const char *, int);
+int realmTrieLookup(const RealmNode *, const char *);
+int canonicalizePath(char *);
+
+/* from upload.c */
+
+int isUploadPathValid(const char *);
+enum codes uploadOpen(const char *, int *, char **);
+enum codes uploadCommit(const char *, int, char *, enum codes);
+enum codes receiveUpload(const char *, BodyReader *, int);
+int parseContentRange(const char *, ContentRange *);
+char* partialUploadPath(const char *);
+long long partialUploadLength(const char *);
+enum codes receivePartialUpload(const char *, BodyReader *,
+		const ContentRange *, int, long long *);
+
+/* from sharedmutex.c */
+
+void* sharedAlloc(size_t);
+int initSharedMutex(pthread_mutex_t *);
+
+/* from server.c */
+
+int writevAll(int, struct iovec *, int);
+int writeAll(int, const char *, int);
+char* makeResponseHeader(enum codes, const char *, long long, int *, int);
 
 #endif /* PROTOTYPES_H_ */
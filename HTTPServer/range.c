@@ -0,0 +1,109 @@
+#include "headers.h"
+#include "structures.h"
+#include "prototypes.h"
+
+/*!
+ * Parses a number of bytes in a range
+ * @param value Text to parse, moved past the number
+ * @param[out] number Will contain the number
+ * @return true if there was a number
+ */
+static int rangeNumber(const char **value, long long *number) {
+	if (!isdigit(**value))
+		return false;
+	char *end;
+	*number = strtoll(*value, &end, 10);
+	*value = end;
+	return true;
+}
+
+/*!
+ * Parses value of Range header of a request, e.g. "bytes=0-499,1000-,-200".
+ * Ranges are clipped to the file, those starting past its end are dropped
+ * @param value Value of the header
+ * @param length Length of the requested file
+ * @param ranges Array for the ranges, with total set to length
+ * @param maxRanges Size of the array
+ * @return Number of ranges, 0 if none of them can be satisfied, -1 if the
+ * header is malformed or has too many ranges and should be ignored
+ */
+int parseRanges(const char *value, off_t length, ContentRange *ranges,
+		int maxRanges) {
+	if (strncasecmp(value, "bytes=", 6))
+		return -1;
+	value += 6;
+
+	int count = 0, given = 0;
+	while (true) {
+		long long first, last = length - 1;
+		value += strspn(value, " \t");
+		if (*value == '-') {
+			/* the last bytes of the file */
+			++value;
+			if (!rangeNumber(&value, &first))
+				return -1;
+			first = first < length ? length - first : 0;
+		} else {
+			if (!rangeNumber(&value, &first) || *value++ != '-')
+				return -1;
+			long long end;
+			if (rangeNumber(&value, &end)) {
+				if (end < first)
+					return -1;
+				if (end < last)
+					last = end;
+			}
+		}
+
+		if (++given > maxRanges)
+			return -1;
+		if (first < length && last >= first) {
+			ranges[count].first = first;
+			ranges[count].last = last;
+			ranges[count].total = length;
+			++count;
+		}
+
+		value += strspn(value, " \t");
+		if (!*value)
+			return count;
+		if (*value++ != ',')
+			return -1;
+	}
+}
+
+/*!
+ * Compares ranges by their first byte, for qsort()
+ * @param a First range
+ * @param b Second range
+ * @return Negative, zero or positive as a starts before, with or after b
+ */
+static int rangeCompare(const void *a, const void *b) {
+	long long first = ((const ContentRange*) a)->first;
+	long long second = ((const ContentRange*) b)->first;
+	return first < second ? -1 : first > second;
+}
+
+/*!
+ * Sorts ranges and merges those which overlap or are separated by fewer than
+ * gap bytes, as sending the gap is cheaper than starting another part
+ * @param ranges Ranges to merge, replaced by the result
+ * @param count Number of ranges
+ * @param gap Longest gap bridged
+ * @return Number of ranges left
+ */
+int coalesceRanges(ContentRange *ranges, int count, off_t gap) {
+	if (count < 2)
+		return count;
+	qsort(ranges, count, sizeof(ContentRange), rangeCompare);
+
+	int i, merged = 0;
+	for (i = 1; i < count; ++i) {
+		if (ranges[i].first <= ranges[merged].last + 1 + gap) {
+			if (ranges[i].last > ranges[merged].last)
+				ranges[merged].last = ranges[i].last;
+		} else
+			ranges[++merged] = ranges[i];
+	}
+	return merged + 1;
+}
@@ -0,0 +1,161 @@
+#include "headers.h"
+#include "structures.h"
+#include "prototypes.h"
+
+/*!
+ * Creates a trie node with a copy of given edge label
+ * @param arena Arena to allocate the node from
+ * @param label Pointer to the label (does not have to be null-terminated)
+ * @param labelLen Length of the label
+ * @return Pointer to newly allocated node, 0 if memory ran out
+ */
+static RealmNode* realmNodeCreate(Arena *arena, const char *label,
+		int labelLen) {
+	RealmNode *node = (RealmNode*) arenaAlloc(arena, sizeof(RealmNode));
+	if (!node || !(node->label = arenaStrndup(arena, label, labelLen)))
+		return 0;
+	node->labelLen = labelLen;
+	node->exact = -1;
+	node->prefix = -1;
+	node->child = 0;
+	node->next = 0;
+	return node;
+}
+
+/*!
+ * Creates an empty trie
+ * @param arena Arena to allocate nodes from
+ * @return Pointer to the root node, 0 if memory ran out
+ */
+RealmNode* realmTrieCreate(Arena *arena) {
+	return realmNodeCreate(arena, "", 0);
+}
+
+/*!
+ * Adds a protected URI to the trie. URI ending with '*' protects every path
+ * starting with the part before the asterisk, so "/private/" followed by '*'
+ * protects the whole "/private/" tree. Otherwise only this exact path is
+ * protected. When the same rule is given twice, the realm configured first
+ * wins
+ * @param arena Arena to allocate nodes from
+ * @param root Root node of the trie
+ * @param uri Protected URI or prefix rule
+ * @param realmIndex Index of the realm protecting this URI
+ * @return 0 on success, -1 if memory ran out, with the trie still valid
+ */
+int realmTrieInsert(Arena *arena, RealmNode *root, const char *uri, int realmIndex) {
+	int len = strlen(uri);
+	int isPrefix = (len > 0 && uri[len - 1] == '*');
+	if (isPrefix)
+		--len;
+
+	RealmNode *node = root;
+	int pos = 0;
+	while (pos < len) {
+		/* find a child sharing the first character */
+		RealmNode *child = node->child;
+		while (child && child->label[0] != uri[pos])
+			child = child->next;
+
+		if (!child) {
+			child = realmNodeCreate(arena, &uri[pos], len - pos);
+			if (!child)
+				return -1;
+			child->next = node->child;
+			node->child = child;
+			node = child;
+			break;
+		}
+
+		/* length of the common part of label and the rest of URI */
+		int common = 0;
+		while (common < child->labelLen && pos + common < len
+				&& child->label[common] == uri[pos + common])
+			++common;
+
+		/* split the edge so that the common part gets its own node */
+		if (common < child->labelLen) {
+			RealmNode *split = realmNodeCreate(arena, child->label, common);
+			if (!split)
+				return -1;
+			split->next = child->next;
+			split->child = child;
+			child->next = 0;
+			memmove(child->label, &child->label[common], child->labelLen
+					- common + 1);
+			child->labelLen -= common;
+
+			RealmNode **link = &node->child;
+			while (*link != child)
+				link = &(*link)->next;
+			*link = split;
+			child = split;
+		}
+
+		node = child;
+		pos += common;
+	}
+
+	if (isPrefix) {
+		if (node->prefix < 0)
+			node->prefix = realmIndex;
+	} else if (node->exact < 0)
+		node->exact = realmIndex;
+	return 0;
+}
+
+/*!
+ * Finds a realm protecting given path. Exact rules win over prefix rules and
+ * longer prefixes win over shorter ones. Cost depends only on path length
+ * @param root Root node of the trie
+ * @param path Requested path
+ * @return Index of the realm, -1 when the path is not protected
+ */
+int realmTrieLookup(const RealmNode *root, const char *path) {
+	const RealmNode *node = root;
+	int found = root->prefix;
+	while (*path) {
+		const RealmNode *child = node->child;
+		while (child && child->label[0] != *path)
+			child = child->next;
+		if (!child || strncmp(child->label, path, child->labelLen))
+			return found;
+		path += child->labelLen;
+		node = child;
+		if (node->prefix >= 0)
+			found = node->prefix;
+	}
+	return node->exact >= 0 ? node->exact : found;
+}
+
+/*!
+ * Brings a request path to the form realm rules are written in, so a rule
+ * can't be walked around by spelling the same file differently. Repeated
+ * slashes and "." components are dropped in place
+ * @param path Requested path, starting with a slash
+ * @return Length of the canonical path, -1 if the path doesn't start with a
+ * single slash or has a ".." component
+ */
+int canonicalizePath(char *path) {
+	if (path[0] != '/' || path[1] == '/')
+		return -1;
+
+	char *out = path + 1;
+	const char *in = path + 1;
+	while (*in) {
+		const char *end = strchrnul(in, '/');
+		int len = end - in;
+		if (len == 2 && in[0] == '.' && in[1] == '.')
+			return -1;
+		/* an empty or "." component is dropped with its slash */
+		if (len && !(len == 1 && in[0] == '.')) {
+			memmove(out, in, len);
+			out += len;
+			if (*end)
+				*out++ = '/';
+		}
+		in = *end ? end + 1 : end;
+	}
+	*out = 0;
+	return out - path;
+}
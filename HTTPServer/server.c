@@ -10,64 +10,69 @@
 #include "prototypes.h"
 #include "mime.h"
 
-/* server configuration */
-const int serverPort = 6666;
-const int queueSize = 20;
-const int maxConnections = 20;
-
-/* timeouts */
-const int serverTimeout = 5;
-const int clientTimeout = 5;
+/* runtime parameters are kept in config->params, see config.c */
 
 /* other constants */
 const int maxCommandLength = 128;
+/* networking processes of upgraded servers which may drain at once */
+const int maxPredecessors = 8;
+/* seconds networking processes get after stopTimeout to terminate their
+ * clients and exit, before they are killed */
+const int stopGrace = 2;
+
+/* environment variables passing the listening socket and the networking
+ * processes of old servers, comma separated, to the new one during an
+ * upgrade */
+const char *listenFdVariable = "HTTP_SERVER_LISTEN_FD";
+const char *predecessorVariable = "HTTP_SERVER_PREDECESSOR";
 
-/* possible server status codes */
-enum codes {
-	ok,
-	created,
-	accepted,
-	noContent,
-	movedPermanently,
-	movedTemporarily,
-	notModified,
-	badRequest,
-	unauthorized,
-	forbidden,
-	notFound,
-	internalServerError,
-	notImplemented,
-	badGateway,
-	serviceUnavailable
-};
 const char *statusCode[] = { "200 OK", "201 Created", "202 Accepted",
-		"204 No Content", "301 Moved Permanently", "302 Moved Temporarily",
-		"304 Not Modified", "400 Bad Request", "401 Unauthorized",
-		"403 Forbidden", "404 Not Found", "500 Internal Server Error",
+		"204 No Content", "206 Partial Content", "301 Moved Permanently",
+		"302 Moved Temporarily", "304 Not Modified", "400 Bad Request",
+		"401 Unauthorized", "403 Forbidden", "404 Not Found",
+		"416 Requested Range Not Satisfiable", "500 Internal Server Error",
 		"501 Not Implemented", "502 Bad Gateway", "503 Service Unavailable" };
 
 /* server response header which is sent to every request */
 const char *serverHeader = "Server: http-server-put\n"
-	"Content-Length: %d\n"
+	"Content-Length: %lld\n"
+	"Content-Type: %s\n"
+	"\n";
+/* the same for responses whose length is not known in advance */
+const char *streamHeader = "Server: http-server-put\n"
 	"Content-Type: %s\n"
 	"\n";
 
 /* prototypes of functions used */
 inline void assert(int, const char*);
 char* createListPage(char*);
-void decode(char*, char*);
 
 /* global variables */
-Realm realm[32];
-int realmCount = 0;
+Config *config;
+AuthCache *authCache;
+AppendLog *appendLog;
+Stats *stats;
+
+/* networking process, which the I/O process passes SIGHUP on to */
+pid_t networkingProcess;
+/* set by SIGHUP in the networking process */
+volatile sig_atomic_t reloadRequested = false;
+/* set by SIGTERM in the networking process, which then stops accepting */
+volatile sig_atomic_t drainRequested = false;
+/* set by SIGUSR1 in the networking process, which then also terminates
+ * requests not finished within stopTimeout */
+volatile sig_atomic_t stopRequested = false;
 
 /**
- * Get a list of headers from a socket
+ * Get a list of headers from a socket. Lines longer than the buffer are read
+ * in pieces, and reading stops once the head exceeds its configured limit
  * @param sockd Input socket
  * @return Pointer to a list of headers
  */
 struct bstrList* getRequest(int sockd) {
-	char buf[1024];
+	int bufferSize = config->params.requestBufferSize;
+	int maxLength = config->params.maxRequestLength;
+	char buf[bufferSize];
 	struct bstrList *requestList;
 	struct bstrList *tempList;
 	bstring line;
@@ -75,17 +80,25 @@ struct bstrList* getRequest(int sockd) {
 	int i = 0;
 	int count = 0;
 	/* read incoming bytes until one empty line is found */
-	while (1) {
+	while (all->slen < maxLength) {
 
-		while (read(sockd, &buf[i], 1) == 1)
+		line = bfromcstr("");
+		while (read(sockd, &buf[i], 1) == 1) {
 			if (buf[i++] == '\n')
 				break;
+			if (i == bufferSize) {
+				bcatblk(line, buf, i);
+				i = 0;
+				if (all->slen + line->slen >= maxLength)
+					break;
+			}
+		}
+		bcatblk(line, buf, i);
 
-		if (i < 3)
+		if (line->slen < 3) {
+			bdestroy(line);
 			break;
-
-		buf[i] = 0;
-		line = bfromcstr(buf);
+		}
 
 		bconcat(all, line);
 
@@ -108,9 +121,56 @@ struct bstrList* getRequest(int sockd) {
 	}
 	requestList = bsplit(all, '\n');
 	bdestroy(all);
+	/* drop carriage returns of CRLF line endings */
+	for (i = 0; i < requestList->qty; ++i)
+		brtrimws(requestList->entry[i]);
 	return requestList;
 }
 
+/**
+ * Creates a buffer with status line and headers of HTTP/1.0 response
+ * @param[in] status Status code of given operation
+ * @param[in] contentType Literal containing one of possible MIME types
+ * @param[in] entitySize Size of entity body which will follow the headers,
+ * -1 if unknown, in which case the body ends when the connection closes
+ * @param[out] headerSize Will contain size of created headers
+ * @return Pointer to buffer containing headers, empty in case of HTTP/0.9
+ */
+char* makeResponseHeader(enum codes status, const char *contentType,
+		long long entitySize, int *headerSize, int httpVersion) {
+	/* in case of http/0.9 response */
+	if (httpVersion == http_0_9) {
+		*headerSize = 0;
+		return (char*) malloc(1);
+	}
+
+	/* status line */
+	char statusLine[64];
+	int statusSize = sprintf(statusLine, "HTTP/1.0 %s\n", statusCode[status]);
+
+	/* line with date */
+	char dateLine[40];
+	struct tm current;
+	now(&current);
+	int dateSize = dateToStr(dateLine, &current);
+
+	/* rest of headers including content-length, if known */
+	int size = statusSize + dateSize + strlen(serverHeader)
+			+ strlen(contentType) + 32;
+	char *header = (char*) malloc(size);
+	memcpy(header, statusLine, statusSize);
+	memcpy(&header[statusSize], dateLine, dateSize);
+	if (entitySize < 0)
+		*headerSize = statusSize + dateSize + snprintf(&header[statusSize
+				+ dateSize], size - statusSize - dateSize, streamHeader,
+				contentType);
+	else
+		*headerSize = statusSize + dateSize + snprintf(&header[statusSize
+				+ dateSize], size - statusSize - dateSize, serverHeader,
+				entitySize, contentType);
+	return header;
+}
+
 /**
  * Creates a buffer with correct HTTP/1.0 response
  * @param[in] status Status code of given operation
@@ -122,45 +182,440 @@ struct bstrList* getRequest(int sockd) {
  */
 char* makeResponseBody(enum codes status, const char *contentType,
 		int entitySize, char *entity, int *responseSize, int httpVersion) {
+	int headerSize;
+	char *response = makeResponseHeader(status, contentType, entitySize,
+			&headerSize, httpVersion);
+	response = (char*) realloc(response, headerSize + entitySize + 1);
+	if (entitySize)
+		memcpy(&response[headerSize], entity, entitySize);
+	*responseSize = headerSize + entitySize;
+	return response;
+}
 
-	char *response;
-	/* in case of http/0.9 response */
-	if (httpVersion == http_0_9) {
-		response = (char*) malloc(entitySize);
-		memcpy((void*) response, (const void*) entity, entitySize);
-		*responseSize = entitySize;
-	} else {/* proceed with a HTTP/1.X response */
-		/* status line */
-		char statusLine[64];
-		int statusSize = sprintf(statusLine, "HTTP/1.0 %s\n",
-				statusCode[status]);
-
-		/* line with date */
-		char dateLine[40];
-		struct tm current;
-		now(&current);
-		int dateSize = dateToStr(dateLine, &current);
-
-		/* rest of headers including content-length */
-		char headerLines[256];
-		int headersSize = sprintf(headerLines, serverHeader, entitySize,
-				contentType);
+/**
+ * Writes whole vector of buffers to a socket or file, retrying after partial
+ * writes and advancing the vector past the data already written
+ * @param fd Output descriptor
+ * @param iov Buffers to write, modified in place
+ * @param count Number of buffers
+ * @return 0 on success, -1 on error
+ */
+int writevAll(int fd, struct iovec *iov, int count) {
+	while (count > 0) {
+		ssize_t written = writev(fd, iov, count);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return -1;
+		while (count > 0 && (size_t) written >= iov->iov_len) {
+			written -= iov->iov_len;
+			++iov;
+			--count;
+		}
+		if (count > 0) {
+			iov->iov_base = (char*) iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+	return 0;
+}
 
-		/* create response */
-		response = (char*) malloc(statusSize + dateSize + headersSize
-				+ entitySize);
-		int i, j = 0;
-		for (i = 0; i < statusSize; ++i)
-			response[j++] = statusLine[i];
-		for (i = 0; i < dateSize; ++i)
-			response[j++] = dateLine[i];
-		for (i = 0; i < headersSize; ++i)
-			response[j++] = headerLines[i];
-		for (i = 0; i < entitySize; ++i)
-			response[j++] = entity[i];
-		*responseSize = j;
+/**
+ * Writes whole buffer to a socket or file, retrying after partial writes
+ * @param fd Output descriptor
+ * @param buffer Data to write
+ * @param size Size of data
+ * @return 0 on success, -1 on error
+ */
+int writeAll(int fd, const char *buffer, int size) {
+	while (size > 0) {
+		int written = write(fd, buffer, size);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return -1;
+		buffer += written;
+		size -= written;
 	}
-	return response;
+	return 0;
+}
+
+/**
+ * Sends a response whose entity is a part of a file. The file goes straight
+ * from page cache to the socket with sendfile(), so it is never copied to
+ * user space no matter how large it is
+ * @param sockd Output socket
+ * @param status Status code of given operation
+ * @param contentType Literal containing one of possible MIME types
+ * @param fd File to send
+ * @param offset Offset of the first byte to send
+ * @param length Number of bytes to send
+ * @return 0 on success, -1 on error
+ */
+int sendFileResponse(int sockd, enum codes status, const char *contentType,
+		int fd, off_t offset, off_t length, int httpVersion) {
+	int headerSize;
+	char *header = makeResponseHeader(status, contentType, length,
+			&headerSize, httpVersion);
+	int result = writeAll(sockd, header, headerSize);
+	free(header);
+
+	while (!result && length > 0) {
+		ssize_t sent = sendfile(sockd, fd, &offset, length);
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent <= 0)
+			result = -1;
+		else
+			length -= sent;
+	}
+	return result;
+}
+
+/**
+ * Sends several ranges of a file as a multipart/byteranges response. Headers
+ * of every part are written with writev() and the data with sendfile(), with
+ * the socket corked, so the parts go out in full packets
+ * @param sockd Output socket
+ * @param contentType MIME type of the file
+ * @param headers Additional headers of the response, separated by newlines
+ * @param fd File to send
+ * @param ranges Ranges of the file, at least two
+ * @param count Number of ranges
+ * @return 0 on success, -1 on error
+ */
+int sendRangesResponse(int sockd, const char *contentType, const char *headers,
+		int fd, const ContentRange *ranges, int count, int httpVersion) {
+	char boundary[24];
+	snprintf(boundary, sizeof(boundary), "%08lx%08x", (unsigned long) time(0),
+			(unsigned int) getpid());
+
+	/* part headers first, the length of the response depends on them */
+	enum {
+		partHeaderSize = 256
+	};
+	char *parts = (char*) malloc(count * partHeaderSize);
+	int partSize[count];
+	long long length = 0;
+	int i;
+	for (i = 0; i < count; ++i) {
+		partSize[i] = snprintf(&parts[i * partHeaderSize], partHeaderSize,
+				"\r\n--%s\r\nContent-Type: %s\r\n"
+					"Content-Range: bytes %lld-%lld/%lld\r\n\r\n", boundary,
+				contentType, ranges[i].first, ranges[i].last, ranges[i].total);
+		if (partSize[i] >= partHeaderSize)
+			partSize[i] = partHeaderSize - 1;
+		length += partSize[i] + ranges[i].last - ranges[i].first + 1;
+	}
+	char closing[32];
+	int closingSize = snprintf(closing, sizeof(closing), "\r\n--%s--\r\n",
+			boundary);
+	length += closingSize;
+
+	char type[512];
+	snprintf(type, sizeof(type), "multipart/byteranges; boundary=%s\n%s",
+			boundary, headers);
+	int headerSize;
+	char *header = makeResponseHeader(partialContent, type, length,
+			&headerSize, httpVersion);
+
+	int cork = 1;
+	setsockopt(sockd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+	struct iovec head[2] = { { header, headerSize }, { parts, partSize[0] } };
+	int result = writevAll(sockd, head, 2);
+	for (i = 0; !result && i < count; ++i) {
+		if (i && writeAll(sockd, &parts[i * partHeaderSize], partSize[i]))
+			result = -1;
+		off_t offset = ranges[i].first;
+		off_t left = ranges[i].last - ranges[i].first + 1;
+		while (!result && left > 0) {
+			ssize_t sent = sendfile(sockd, fd, &offset, left);
+			if (sent < 0 && errno == EINTR)
+				continue;
+			if (sent <= 0)
+				result = -1;
+			else
+				left -= sent;
+		}
+	}
+	if (!result)
+		result = writeAll(sockd, closing, closingSize);
+	cork = 0;
+	setsockopt(sockd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+
+	free(header);
+	free(parts);
+	return result;
+}
+
+/**
+ * Compares a password sent by a client with the configured one. Passwords
+ * starting with '$' are crypt(3) hashes, e.g. SHA-256-crypt or bcrypt.
+ * Comparison takes the same time no matter where the first difference is
+ * @param pass Password sent by the client
+ * @param expected Configured password or hash
+ * @return true if passwords match, false otherwise
+ */
+int checkPassword(const char *pass, const char *expected) {
+	static struct crypt_data data;
+	long long start = nowMicros();
+	const char *given = pass;
+	if (expected[0] == '$') {
+		data.initialized = 0;
+		given = crypt_r(pass, expected, &data);
+		if (!given)
+			given = "";
+	}
+
+	int len = strlen(expected);
+	unsigned char difference = (strlen(given) != len);
+	int i;
+	for (i = 0; i < len && given[i]; ++i)
+		difference |= given[i] ^ expected[i];
+
+	if (stats)
+		histogramRecord(&stats->authLatency, nowMicros() - start);
+	return !difference;
+}
+
+/**
+ * Checks credentials sent by a client. Successful verifications are cached,
+ * so a client repeating the same header skips decoding and comparison
+ * @param header Line of request with Authorization header
+ * @param realmIndex Index of the realm protecting requested URI
+ * @return true if login and password match the realm, false otherwise
+ */
+int checkAuthorization(bstring header, int realmIndex) {
+	if (authCacheLookup(authCache, (const char*) header->data, header->slen,
+			realmIndex, config->generation))
+		return true;
+
+	/* decode base64 data */
+	const int prefixLen = strlen("Authorization: Basic ");
+	if (header->slen < prefixLen)
+		return false;
+	const char *encoded = (const char*) &header->data[prefixLen];
+	int encodedLen = header->slen - prefixLen;
+	while (encodedLen > 0 && isspace(encoded[encodedLen - 1]))
+		--encodedLen;
+	char dataDecoded[256];
+	int decodedLen = base64Decode(encoded, encodedLen,
+			(unsigned char*) dataDecoded, sizeof(dataDecoded) - 1);
+	if (decodedLen < 0)
+		return false;
+	dataDecoded[decodedLen] = 0;
+
+	/* split decoded input into login and pass */
+	char *login = dataDecoded;
+	char *pass = strchr(dataDecoded, ':');
+	if (!pass)
+		return false;
+	*(pass++) = 0;
+
+	Realm *realm = &config->realm[realmIndex];
+	if (strcmp(login, realm->login) || !checkPassword(pass, realm->pass))
+		return false;
+
+	authCacheStore(authCache, (const char*) header->data, header->slen,
+			realmIndex, config->generation, config->params.authCacheTTL);
+	return true;
+}
+
+/**
+ * Checks whether a POST may write to a file named in its body. The name goes
+ * through the same canonicalization and realm rules as a request URI, as the
+ * URI of a POST needn't be anywhere near the file
+ * @param post State of the request
+ * @param path Path of the file relative to the server directory
+ * @return true if the file may be written, false otherwise
+ */
+int postPathAllowed(const PostRequest *post, const char *path) {
+	char canonical[sizeof(post->partPath) + 1];
+	if (!isUploadPathValid(path) || snprintf(canonical, sizeof(canonical),
+			"/%s", path) >= sizeof(canonical) || canonicalizePath(canonical)
+			< 0)
+		return false;
+	int realmIndex = realmTrieLookup(config->realmTrie, canonical);
+	return realmIndex < 0 || (post->authorization && checkAuthorization(
+			post->authorization, realmIndex));
+}
+
+/**
+ * Receives fields of a form sent with POST. The "filename" field names a
+ * file (created if needed), the "phrase" field is appended to it as a line
+ * @param context Pointer to PostRequest
+ * @param name Name of the field
+ * @param value Decoded piece of the value
+ * @param len Length of the piece
+ * @param last Whether this is the last piece of the value
+ */
+void postField(void *context, const char *name, const char *value, int len,
+		int last) {
+	PostRequest *post = (PostRequest*) context;
+
+	if (!strcmp(name, "filename")) {
+		if (post->fd >= 0 || post->filenameLength + len
+				>= sizeof(post->filename)) {
+			post->error = true;
+			return;
+		}
+		memcpy(&post->filename[post->filenameLength], value, len);
+		post->filenameLength += len;
+		if (last) {
+			post->filename[post->filenameLength] = 0;
+			if (!postPathAllowed(post, post->filename)) {
+				post->denied = true;
+				post->error = true;
+				return;
+			}
+			post->fd = fsOpenat(post->filename, O_RDWR | O_CREAT | O_APPEND,
+					0666);
+			if (post->fd < 0)
+				post->error = true;
+			else
+				appendInit(&post->append, appendLog, post->fd);
+		}
+	} else if (!strcmp(name, "phrase")) {
+		/* a phrase is only accepted after the file name */
+		if (post->fd < 0) {
+			post->error = true;
+			return;
+		}
+		if (appendWrite(&post->append, value, len))
+			post->error = true;
+		if (last) {
+			if (appendCommit(&post->append))
+				post->error = true;
+			post->saved = true;
+		}
+	}
+}
+
+/**
+ * Starts a part of a multipart/form-data POST. A file part is received into
+ * a temporary file in the directory of the request URI
+ * @param context Pointer to PostRequest
+ * @param name Name of the part
+ * @param filename File name sent by the client, 0 for plain fields
+ * @return 0 on success, -1 if the file can't be stored
+ */
+int postPart(void *context, const char *name, const char *filename) {
+	PostRequest *post = (PostRequest*) context;
+	post->inFile = filename != 0;
+	post->partFd = -1;
+	if (!filename)
+		return 0;
+
+	/* some browsers send full paths, only the last component is used */
+	const char *base = filename + strlen(filename);
+	while (base > filename && base[-1] != '/' && base[-1] != '\\')
+		--base;
+	/* no file was chosen */
+	if (!*base)
+		return 0;
+
+	if (snprintf(post->partPath, sizeof(post->partPath), "%.*s%s",
+			post->directoryLength, post->directory, base)
+			>= sizeof(post->partPath))
+		post->error = true;
+	else if (!postPathAllowed(post, post->partPath))
+		post->denied = post->error = true;
+	else if (uploadOpen(post->partPath, &post->partFd, &post->partTemp) != ok)
+		post->error = true;
+	if (post->error) {
+		post->partFd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Receives contents of parts of a multipart/form-data POST. Files are written
+ * as they come, plain fields are handled like in urlencoded forms
+ * @param context Pointer to PostRequest
+ * @param name Name of the part
+ * @param value Piece of the contents
+ * @param len Length of the piece
+ * @param last Whether this is the last piece of the part
+ */
+void postPartData(void *context, const char *name, const char *value, int len,
+		int last) {
+	PostRequest *post = (PostRequest*) context;
+	if (!post->inFile) {
+		postField(context, name, value, len, last);
+		return;
+	}
+	if (post->partFd < 0)
+		return;
+
+	enum codes status = ok;
+	if (len && fsWrite(post->partFd, value, len))
+		status = internalServerError;
+	if (last || status != ok) {
+		status = uploadCommit(post->partPath, post->partFd, post->partTemp,
+				status);
+		post->partFd = -1;
+		if (status == created || status == noContent) {
+			bcatcstr(post->stored, post->partPath);
+			bconchar(post->stored, '\n');
+		} else
+			post->error = true;
+	}
+}
+
+/**
+ * Reads a multipart/form-data body of a POST, storing files and passing
+ * plain fields to postField()
+ * @param post State of the request
+ * @param body Reader of the body
+ * @param contentType Value of Content-Type header
+ */
+void postMultipart(PostRequest *post, BodyReader *body,
+		const char *contentType) {
+	const Params *params = &config->params;
+	MultipartParser *parser = (MultipartParser*) malloc(
+			sizeof(MultipartParser));
+	post->partFd = -1;
+	if (multipartInit(parser, contentType, params->maxFieldLength,
+			params->maxFilePartLength, params->maxMultipartLength, postPart,
+			postPartData, post) < 0)
+		post->error = true;
+
+	while (!post->error) {
+		int size;
+		char *buffer = multipartBuffer(parser, &size);
+		size = bodyRead(body, buffer, size);
+		if (size <= 0) {
+			if (size < 0)
+				post->error = true;
+			break;
+		}
+		if (multipartParse(parser, size) < 0)
+			post->error = true;
+	}
+	if (multipartFinish(parser) < 0)
+		post->error = true;
+
+	/* remove a file whose part didn't end */
+	if (post->partFd >= 0)
+		uploadCommit(post->partPath, post->partFd, post->partTemp, badRequest);
+	free(parser);
+}
+
+/**
+ * Prepares Content-Type and Range headers telling how much of a resumable
+ * upload is on disk; Range is left out while nothing is
+ * @param header Buffer for the headers
+ * @param size Size of the buffer
+ * @param committed Length of the upload received so far
+ */
+void uploadRangeHeader(char *header, int size, long long committed) {
+	if (committed > 0)
+		snprintf(header, size,
+				"text/html; charset=utf-8\nRange: bytes=0-%lld",
+				committed - 1);
+	else
+		snprintf(header, size, "text/html; charset=utf-8");
 }
 
 /**
@@ -172,12 +627,11 @@ char* makeResponseBody(enum codes status, const char *contentType,
 char* createResponse(struct bstrList *requestList, int *responseSize, int sockd) {
 	bstring method = 0, uri = 0, version = 0;
 	int fd;
-	int ignoreDate = 1;
 	char *response;
 	struct bstrList *currentLine = 0;
-	struct tm reqestedDate, lastMod;
 
 	int httpVersion = http_1_0;
+	const Params *params = &config->params;
 
 	/* read request line */
 	currentLine = bsplit(requestList->entry[0], ' ');
@@ -215,77 +669,61 @@ char* createResponse(struct bstrList *requestList, int *responseSize, int sockd)
 		goto ResponseCreated;
 	}
 
-	/* GET */
+	/* realm rules and file names both see the canonical path */
+	int canonicalLength = canonicalizePath((char*) uri->data);
+	if (canonicalLength < 0) {
+		response = makeResponseBody(badRequest, "text/html; charset=utf-8",
+				strlen(badRequestPage), (char*) badRequestPage, responseSize,
+				httpVersion);
+		goto ResponseCreated;
+	}
+	uri->slen = canonicalLength;
+
+	/* check if authorization header was sent; POST needs it also for the
+	 * files named in its body */
 	int i, j, k;
-	if (biseqcstr(method, "GET")) {
-		/* check if authorization header was sent */
-		for (i = 1; i < requestList->qty; ++i) {
-			if (!(strncmp((char *) requestList->entry[i]->data,
-					"Authorization:", 14)))
-				break;
-		}
-		int isAuthenticated;
-		char login[256], pass[256];
-		memset(login, 0, sizeof(login));
-		memset(pass, 0, sizeof(pass));
-		if (i == requestList->qty)
-			isAuthenticated = false;
-		else {
-			/* if client authorizes itself, decode base64 data */
-			isAuthenticated = true;
-			char dataEncoded[256], dataDecoded[256];
-			memset(dataEncoded, 0, sizeof(dataEncoded));
-			memset(dataDecoded, 0, sizeof(dataDecoded));
-			for (j = strlen("Authorization: Basic "), k = 0; j
-					< requestList->entry[i]->slen; ++j, ++k)
-				dataEncoded[k] = requestList->entry[i]->data[j];
-			dataEncoded[k] = 0;
-			decode(dataEncoded, dataDecoded);
-
-			/* split decoded input into login and pass */
-			char *cur = dataDecoded;
-			char *which = login;
-			while (*cur) {
-				if (*cur == ':')
-					which = pass;
-				else
-					*(which++) = *cur;
-				++cur;
-			}
+	bstring authorization = 0;
+	for (j = 1; j < requestList->qty; ++j) {
+		if (!(strncmp((char *) requestList->entry[j]->data,
+				"Authorization:", 14))) {
+			authorization = requestList->entry[j];
+			break;
 		}
+	}
 
-		/* check if access is authenticated */
-		for (i = 0; i < realmCount; ++i) {
-			for (j = 0; j < realm[i].count; ++j)
-				if (!(strcmp((char*) uri->data, realm[i].uri[j])))
-					break;
-			if (j != realm[i].count)
-				break;
+	/* check if access is authenticated; HEAD tells whether files exist and
+	 * how much of an upload was received, so it is protected as well */
+	i = -1;
+	if (biseqcstr(method, "GET") || biseqcstr(method, "PUT") || biseqcstr(
+			method, "POST") || biseqcstr(method, "HEAD"))
+		i = realmTrieLookup(config->realmTrie, (char*) uri->data);
+	if (i >= 0) {
+		/* if access is authenticated, yet no authorization from client
+		 * send 401 Unathorized */
+		if (!authorization) {
+			char additionalHeader[256];
+			snprintf(
+					additionalHeader,
+					sizeof(additionalHeader),
+					"text/html; charset=utf-8\nWWW-Authenticate: Basic realm=\"%s\"",
+					config->realm[i].name);
+			response = makeResponseBody(unauthorized, additionalHeader,
+					strlen(unauthorizedPage), (char*) unauthorizedPage,
+					responseSize, httpVersion);
+			goto ResponseCreated;
 		}
-		if (i != realmCount) {
-			/* if access is authenticated, yet no authorization from client
-			 * send 401 Unathorized */
-			if (!isAuthenticated) {
-				char additionalHeader[256];
-				sprintf(
-						additionalHeader,
-						"text/html; charset=utf-8\nWWW-Authenticate: Basic realm=\"%s\"",
-						realm[i].name);
-				response = makeResponseBody(unauthorized, additionalHeader,
-						strlen(unauthorizedPage), (char*) unauthorizedPage,
-						responseSize, httpVersion);
-				goto ResponseCreated;
-				/* if access is authentitaced, yet authorization fails
-				 * send 403 Forbidden */
-			} else if (strcmp(login, realm[i].login) || strcmp(pass,
-					realm[i].pass)) {
-				response = makeResponseBody(forbidden,
-						"text/html; charset=utf-8", strlen(forbiddenPage),
-						(char*) forbiddenPage, responseSize, httpVersion);
-				goto ResponseCreated;
-			}
+		/* if access is authentitaced, yet authorization fails
+		 * send 403 Forbidden */
+		if (!checkAuthorization(authorization, i)) {
+			response = makeResponseBody(forbidden,
+					"text/html; charset=utf-8", strlen(forbiddenPage),
+					(char*) forbiddenPage, responseSize, httpVersion);
+			goto ResponseCreated;
 		}
+	}
 
+	/* GET */
+	if (biseqcstr(method, "GET")) {
 		/* request for root directory */
 		if (blength(uri) == 1 && uri->data[0] == '/') {
 			char *listPage = createListPage("");
@@ -296,7 +734,7 @@ char* createResponse(struct bstrList *requestList, int *responseSize, int sockd)
 		}
 
 		/* check if resource exists */
-		fd = openat(AT_FDCWD, (const char*) &uri->data[1], O_RDONLY);
+		fd = fsOpenat((const char*) &uri->data[1], O_RDONLY, 0);
 		if (fd < 0) {
 			response = makeResponseBody(notFound, "text/html; charset=utf-8",
 					strlen(notFoundPage), (char*) notFoundPage, responseSize,
@@ -304,19 +742,28 @@ char* createResponse(struct bstrList *requestList, int *responseSize, int sockd)
 			goto ResponseCreated;
 		}
 
-		/* check if it's a directory or file */
+		/* check if it's a directory or file; the opened one, as the path may
+		 * have been replaced by an upload meanwhile */
 		struct stat attrib;
-		fstatat(AT_FDCWD, (const char*) &uri->data[1], &attrib, 0);
+		fstat(fd, &attrib);
 
 		/* if directory, then list its content */
 		if (S_ISDIR(attrib.st_mode)) {
+			close(fd);
 			/* if URI does not end with'/', then redirect */
 			if (uri->data[uri->slen - 1] != '/') {
-				char additionalHeader[128];
-				sprintf(
-						additionalHeader,
-						"text/html; charset=utf-8\nLocation: http://localhost:6666%s/",
-						uri->data);
+				/* the client knows under which name it reached the server;
+				 * anything else than host[:port] could inject headers */
+				char host[32];
+				const char *hostHeader = findHeader(requestList, "Host");
+				if (!hostHeader || !isValidHost(hostHeader)) {
+					snprintf(host, sizeof(host), "localhost:%d", params->port);
+					hostHeader = host;
+				}
+				char additionalHeader[strlen(hostHeader) + uri->slen + 64];
+				sprintf(additionalHeader,
+						"text/html; charset=utf-8\nLocation: http://%s%s/",
+						hostHeader, uri->data);
 				response = makeResponseBody(movedPermanently, additionalHeader,
 						0, 0, responseSize, httpVersion);
 				goto ResponseCreated;
@@ -345,135 +792,220 @@ char* createResponse(struct bstrList *requestList, int *responseSize, int sockd)
 			contentType = mimeTypes[j];
 		}
 
-		/* handle the if-modified-since header */
-		for (i = 0; i < requestList->qty; i++)
-			if (bisstemeqblk(requestList->entry[i], "If-Modified-Since: ",
-					strlen("If-Modified-Since: "))) {
-				close(fd);
-				fileModDate((const char *) &uri->data[1], &lastMod);
-
-				bdelete(requestList->entry[i], 0, strlen("If-Modified-Since: "));
-				parseDate(bdata(requestList->entry[i]),&reqestedDate);
-				ignoreDate = 0;
-
-			}
+		char lastModified[40];
+		httpDateToStr(lastModified, sizeof(lastModified), attrib.st_mtime);
 
-		/* read requested URI and create a response out of it */
-		if ((ignoreDate) || (compareDates(&reqestedDate, &lastMod) >= 0)) {
-			openat(AT_FDCWD, (const char*) &uri->data[1], O_RDONLY);
-			int size = lseek(fd, 0, SEEK_END);
-			char *buffer = (char*) malloc(size);
-			lseek(fd, SEEK_SET, 0);
-			read(fd, buffer, size);
-			response = makeResponseBody(ok, contentType, size, buffer,
-					responseSize, httpVersion);
-			free(buffer);
-			goto ResponseCreated;
-		} else {
+		/* handle the if-modified-since header */
+		const char *since = findHeader(requestList, "If-Modified-Since");
+		if (since && parseHttpDate(since) >= attrib.st_mtime) {
+			close(fd);
 			response = makeResponseBody(notModified, "text/html", 0,
 					(char *) 0, responseSize, httpVersion);
 			goto ResponseCreated;
 		}
+
+		/* ranges are served only if the client has the current version */
+		ContentRange ranges[params->maxRanges];
+		int rangeCount = -1;
+		const char *range = findHeader(requestList, "Range");
+		const char *ifRange = findHeader(requestList, "If-Range");
+		if (range && (!ifRange || parseHttpDate(ifRange) == attrib.st_mtime))
+			rangeCount = parseRanges(range, attrib.st_size, ranges,
+					params->maxRanges);
+
+		/* send the file, or its part, directly from the page cache */
+		char additionalHeader[512];
+		if (!rangeCount) {
+			snprintf(additionalHeader, sizeof(additionalHeader),
+					"text/html; charset=utf-8\nContent-Range: bytes */%lld",
+					(long long) attrib.st_size);
+			response = makeResponseBody(rangeNotSatisfiable, additionalHeader,
+					0, (char *) 0, responseSize, httpVersion);
+		} else if (rangeCount > 1 && (rangeCount = coalesceRanges(ranges,
+				rangeCount, params->rangeCoalesceGap)) > 1) {
+			snprintf(additionalHeader, sizeof(additionalHeader),
+					"Last-Modified: %s", lastModified);
+			sendRangesResponse(sockd, contentType, additionalHeader, fd,
+					ranges, rangeCount, httpVersion);
+			response = 0;
+			*responseSize = 0;
+		} else if (rangeCount == 1) {
+			snprintf(additionalHeader, sizeof(additionalHeader),
+					"%s\nLast-Modified: %s\nContent-Range: bytes %lld-%lld/%lld",
+					contentType, lastModified, ranges[0].first, ranges[0].last,
+					ranges[0].total);
+			sendFileResponse(sockd, partialContent, additionalHeader, fd,
+					ranges[0].first, ranges[0].last - ranges[0].first + 1,
+					httpVersion);
+			response = 0;
+			*responseSize = 0;
+		} else {
+			/* a precompressed copy is sent to clients accepting it, else
+			 * a cached compressed one, or one compressed while sending if
+			 * the file is too long to cache; ranges always refer to the
+			 * file itself */
+			const char *coding = "gzip";
+			struct stat encoded;
+			const char *acceptEncoding = findHeader(requestList,
+					"Accept-Encoding");
+			int encodedFd = -1;
+			if (!range && (encodedFd = openSidecar((const char*) &uri->data[1],
+					acceptEncoding, &attrib, &encoded, &coding)) < 0)
+				encodedFd = openCompressed((const char*) &uri->data[1], fd,
+						acceptEncoding, contentType, &attrib, &encoded);
+			if (encodedFd >= 0) {
+				snprintf(additionalHeader, sizeof(additionalHeader),
+						"%s\nLast-Modified: %s\nContent-Encoding: %s\n"
+							"Vary: Accept-Encoding", contentType, lastModified,
+						coding);
+				sendFileResponse(sockd, ok, additionalHeader, encodedFd, 0,
+						encoded.st_size, httpVersion);
+				close(encodedFd);
+			} else if (!range && compressesWhileSending(acceptEncoding,
+					contentType, &attrib)) {
+				snprintf(additionalHeader, sizeof(additionalHeader),
+						"%s\nLast-Modified: %s\nContent-Encoding: gzip\n"
+							"Vary: Accept-Encoding", contentType, lastModified);
+				sendCompressed(sockd, fd, additionalHeader, httpVersion);
+			} else {
+				snprintf(additionalHeader, sizeof(additionalHeader),
+						"%s\nLast-Modified: %s\nAccept-Ranges: bytes\n"
+							"Vary: Accept-Encoding", contentType, lastModified);
+				sendFileResponse(sockd, ok, additionalHeader, fd, 0,
+						attrib.st_size, httpVersion);
+			}
+			response = 0;
+			*responseSize = 0;
+		}
+		close(fd);
+		goto ResponseCreated;
+
 		/* POST */
 	} else if (biseqcstr(currentLine->entry[0], "POST")) {
-		bstring content;
-
-		struct bstrList *tempLine;
-		struct bstrList *nameValue;
-		int requestContentLen = -1;
-
-		/* get content length */
-		for (i = 0; i < requestList->qty; i++) {
-			tempLine = bsplit(requestList->entry[i], ' ');
-			if (biseqcstr(tempLine->entry[0], "Content-Length:")) {
-				requestContentLen
-						= atoi((const char*) tempLine->entry[1]->data);
-				break;
-			}
-			bstrListDestroy(tempLine);
+		/* get content and process it chunk by chunk */
+		PostRequest post;
+		memset(&post, 0, sizeof(post));
+		post.fd = -1;
+		post.authorization = authorization;
+		post.stored = bfromcstr("");
+		/* files sent as multipart/form-data go to the directory of the URI */
+		post.directory = (const char*) &uri->data[1];
+		const char *slash = strrchr(post.directory, '/');
+		post.directoryLength = slash ? slash - post.directory + 1 : 0;
+
+		const char *contentType = findHeader(requestList, "Content-Type");
+		BodyReader body;
+		if (bodyInitFromRequest(&body, sockd, requestList))
+			post.error = true;
+		else if (contentType && !strncasecmp(contentType,
+				"multipart/form-data", 19))
+			postMultipart(&post, &body, contentType);
+		else if (body.chunked || body.remaining <= params->maxFormLength) {
+			FormParser parser;
+			formInit(&parser, params->maxFieldLength, params->maxFormLength,
+					postField, &post);
+
+			char buffer[4096];
+			int size;
+			while (!post.error && (size = bodyRead(&body, buffer,
+					sizeof(buffer))) != 0)
+				if (size < 0 || formParse(&parser, buffer, size) < 0)
+					post.error = true;
+			/* a truncated body must not complete the last field */
+			if (!post.error && formFinish(&parser) < 0)
+				post.error = true;
+		}
+		else
+			post.error = true;
+
+		/* drop a phrase which didn't end */
+		if (post.fd >= 0)
+			appendAbort(&post.append);
+
+		/* a named file is protected by a realm */
+		if (post.denied) {
+			response = makeResponseBody(forbidden, "text/html; charset=utf-8",
+					strlen(forbiddenPage), (char *) forbiddenPage,
+					responseSize, httpVersion);
 		}
 
 		/* bad request */
-		if (requestContentLen < 0) {
+		else if (post.error || (!post.saved && !post.stored->slen)) {
 			response = makeResponseBody(badRequest, "text/html; charset=utf-8",
 					strlen(badRequestPage), (char *) badRequestPage,
 					responseSize, httpVersion);
-
 		}
 
-		/* get content and process it */
-		else {
-
-			char * temp;
-			temp = (char *) malloc(requestContentLen + 1);
-
-			read(sockd, temp, requestContentLen);
-			temp[requestContentLen] = '\0';
-			content = bfromcstr(temp);
-			free(temp);
-
-			tempLine = bsplit(content, '&');
-
-			/* for each name=value pair */
-			for (i = 0; i < tempLine->qty; i++) {
-				nameValue = bsplit(tempLine->entry[i], '=');
-
-				/* get param name */
-				if (biseqcstr(nameValue->entry[0], "filename")) {
-					fd = openat(AT_FDCWD,
-							(const char*) nameValue->entry[1]->data, O_RDONLY);
-					/* create */
-					if (fd < 0) {
-
-						fd = openat(AT_FDCWD,
-								(const char*) nameValue->entry[1]->data, O_RDWR
-										| O_CREAT, 0666);
-
-						lseek(fd, SEEK_SET,0);
-					}
-					/* append */
-					else {
-						close(fd);
-						openat(AT_FDCWD,
-								(const char*) nameValue->entry[1]->data, O_RDWR
-										| O_APPEND);
-						lseek(fd, SEEK_END,0);
-
-					}
-
-				}
-				/* save the phrase */
-				else if (biseqcstr(nameValue->entry[0], "phrase")) {
-
-					/* for handling char-coding issues */
-					bstring plus = bfromcstr("+");
-					bstring wspace = bfromcstr(" ");
-					bfindreplace(nameValue->entry[1], plus, wspace, 0);
-
-					/* save phrase */
-					write(fd, (const char *) bdata(nameValue->entry[1]), nameValue->entry[1]->slen);
-					write(fd, (const char *) "\n", 1);
-					lseek(fd, SEEK_SET,0);
-					i = 0;
-					temp = malloc(4096);
-					while (read(fd, &temp[i++], 1) > 0)
-						;
-
-					response = makeResponseBody(created,
-							"text/plain; charset=utf-8", i, temp, responseSize,
-							httpVersion);
-					close(fd);
-
-					free(temp);
-					bdestroy(plus);
-					bdestroy(wspace);
-				}
-
-				bstrListDestroy(nameValue);
-			}
+		/* send the whole file back, up to the last complete line */
+		else if (post.saved) {
+			sendFileResponse(sockd, created, "text/plain; charset=utf-8",
+					post.fd, 0, appendedLength(post.fd), httpVersion);
+			response = 0;
+			*responseSize = 0;
+		}
 
-			bstrListDestroy(tempLine);
+		/* list the stored files */
+		else
+			response = makeResponseBody(created, "text/plain; charset=utf-8",
+					post.stored->slen, (char *) post.stored->data,
+					responseSize, httpVersion);
 
+		if (post.fd >= 0)
+			close(post.fd);
+		bdestroy(post.stored);
+
+		/* PUT */
+	} else if (biseqcstr(method, "PUT")) {
+		enum codes status = badRequest;
+		BodyReader body;
+		ContentRange range;
+		long long committed = -1;
+		const char *contentRange = findHeader(requestList, "Content-Range");
+		if (bodyInitFromRequest(&body, sockd, requestList))
+			status = badRequest;
+		/* a piece of a resumable upload */
+		else if (contentRange) {
+			if (!parseContentRange(contentRange, &range))
+				status = receivePartialUpload((const char*) &uri->data[1],
+						&body, &range, params->uploadChunkSize, &committed);
+		} else
+			status = receiveUpload((const char*) &uri->data[1], &body,
+					params->uploadChunkSize);
+
+		char additionalHeader[128];
+		switch (status) {
+		case created:
+		case noContent:
+			response = makeResponseBody(status, "text/html; charset=utf-8", 0,
+					(char*) 0, responseSize, httpVersion);
+			break;
+		case accepted:
+		case rangeNotSatisfiable:
+			uploadRangeHeader(additionalHeader, sizeof(additionalHeader),
+					committed);
+			response = makeResponseBody(status, additionalHeader, 0, (char*) 0,
+					responseSize, httpVersion);
+			break;
+		case notFound:
+			response = makeResponseBody(notFound, "text/html; charset=utf-8",
+					strlen(notFoundPage), (char*) notFoundPage, responseSize,
+					httpVersion);
+			break;
+		case forbidden:
+			response = makeResponseBody(forbidden, "text/html; charset=utf-8",
+					strlen(forbiddenPage), (char*) forbiddenPage,
+					responseSize, httpVersion);
+			break;
+		case badRequest:
+			response = makeResponseBody(badRequest, "text/html; charset=utf-8",
+					strlen(badRequestPage), (char*) badRequestPage,
+					responseSize, httpVersion);
+			break;
+		default:
+			/* the upload failed on the server's side */
+			response = makeResponseBody(internalServerError,
+					"text/html; charset=utf-8", strlen(internalServerErrorPage),
+					(char*) internalServerErrorPage, responseSize, httpVersion);
 		}
 
 		/* HEAD */
@@ -481,8 +1013,19 @@ char* createResponse(struct bstrList *requestList, int *responseSize, int sockd)
 		bdelete(currentLine->entry[1], 0, 1); // to remove unnecessary "/" character
 
 
-		fd = openat(AT_FDCWD, (const char*) currentLine->entry[1]->data,
-				O_RDONLY);
+		/* tell how much of a resumable upload was received */
+		long long committed = partialUploadLength(
+				(const char*) currentLine->entry[1]->data);
+		if (committed >= 0) {
+			char additionalHeader[128];
+			uploadRangeHeader(additionalHeader, sizeof(additionalHeader),
+					committed);
+			response = makeResponseBody(accepted, additionalHeader, 0,
+					(char*) 0, responseSize, httpVersion);
+			goto ResponseCreated;
+		}
+
+		fd = fsOpenat((const char*) currentLine->entry[1]->data, O_RDONLY, 0);
 
 		if (fd < 0)
 			response = makeResponseBody(notFound, "text/html; charset=utf-8",
@@ -519,14 +1062,9 @@ char* createResponse(struct bstrList *requestList, int *responseSize, int sockd)
 				strlen(notImplementedPage), (char*) notImplementedPage,
 				responseSize, httpVersion);
 
-	/* clean up all the structures used */
-	ResponseCreated: if (method)
-		bdestroy(method);
-	if (uri)
-		bdestroy(uri);
-	if (version)
-		bdestroy(version);
-	if (currentLine)
+	/* clean up all the structures used; method, uri and version belong to
+	 * currentLine */
+	ResponseCreated: if (currentLine)
 		bstrListDestroy(currentLine);
 
 	return response;
@@ -545,7 +1083,7 @@ char* createListPage(char *path) {
 
 	/* list files in it */
 	struct dirent **namelist;
-	int count = scandir(buffer, &namelist, 0, alphasort);
+	int count = fsScandir(buffer, &namelist);
 
 	/* prepare final page */
 	const char* start = "<html>\n"
@@ -580,55 +1118,348 @@ char* createListPage(char *path) {
 	return page;
 }
 
+/**
+ * Asks the networking process to reload configuration; handler of SIGHUP
+ * @param signal Number of the signal
+ */
+void requestReload(int signal) {
+	reloadRequested = true;
+}
+
+/**
+ * Passes SIGHUP on to the networking process; handler of the I/O process
+ * @param signal Number of the signal
+ */
+void forwardReload(int signal) {
+	kill(networkingProcess, SIGHUP);
+}
+
+/**
+ * Makes the networking process stop accepting connections and exit once its
+ * requests are served; handler of SIGTERM
+ * @param signal Number of the signal
+ */
+void requestDrain(int signal) {
+	drainRequested = true;
+}
+
+/**
+ * Makes the networking process stop accepting connections and exit once its
+ * requests are served or terminated after stopTimeout, even if it was
+ * already draining after an upgrade; handler of SIGUSR1
+ * @param signal Number of the signal
+ */
+void requestStop(int signal) {
+	stopRequested = true;
+	drainRequested = true;
+}
+
+/**
+ * Reaps finished client processes and frees their slots
+ * @param sigFd Non-blocking signalfd receiving SIGCHLD
+ * @param clients Table of clients
+ */
+void reapClients(int sigFd, ClientTable *clients) {
+	/* signals of children finishing together are merged, so the pending
+	 * ones only tell that waitpid() has something to report */
+	struct signalfd_siginfo info[16];
+	while (read(sigFd, info, sizeof(info)) > 0)
+		;
+
+	pid_t pid;
+	while ((pid = waitpid(-1, 0, WNOHANG)) > 0)
+		clientSlotReleasePid(clients, pid);
+}
+
+/**
+ * Waits until client processes finish their requests. Once the server is
+ * stopping, even if only while waiting, those still working after the stop
+ * timeout are terminated
+ * @param clients Table of clients
+ * @param timeout Seconds to wait after a stop is requested
+ */
+void drainClients(ClientTable *clients, int timeout) {
+	int maxConnections = clients->size;
+	char inProgress[maxConnections];
+	int pending = 0, drained = 0, aborted = 0, signalled = false;
+	int i;
+	for (i = 0; i < maxConnections; i++) {
+		inProgress[i] = clients->slot[i].status != empty;
+		pending += inProgress[i];
+	}
+	if (pending)
+		printf("Waiting for %d requests in progress\n", pending);
+	fflush(stdout);
+
+	long long deadline = -1;
+	while (pending > 0) {
+		if (stopRequested && deadline < 0)
+			deadline = nowMicros() + timeout * 1000000LL;
+		int status;
+		pid_t pid = waitpid(-1, &status, WNOHANG);
+		if (pid < 0 && errno != EINTR)
+			break;
+		if (pid > 0) {
+			clientSlotReleasePid(clients, pid);
+			for (i = 0; i < maxConnections; i++)
+				if (inProgress[i] && clients->slot[i].procid == pid) {
+					inProgress[i] = false;
+					--pending;
+					if (WIFSIGNALED(status))
+						++aborted;
+					else
+						++drained;
+				}
+			continue;
+		}
+
+		/* stragglers are terminated directly, no shell involved */
+		if (deadline >= 0 && !signalled && nowMicros() >= deadline) {
+			for (i = 0; i < maxConnections; i++)
+				if (inProgress[i])
+					kill(clients->slot[i].procid, SIGTERM);
+			signalled = true;
+		}
+		usleep(10000);
+	}
+	/* reap processes which finished before */
+	pid_t pid;
+	while ((pid = waitpid(-1, 0, WNOHANG)) > 0)
+		clientSlotReleasePid(clients, pid);
+	printf("Requests finished: %d, aborted: %d\n", drained, aborted);
+	fflush(stdout);
+}
+
+/**
+ * Gets the listening socket, inherited from the server being upgraded or
+ * bound to the configured port
+ * @param params Runtime parameters
+ * @return Listening socket
+ */
+int openListener(const Params *params) {
+	const char *inherited = getenv(listenFdVariable);
+	if (inherited) {
+		int serverSocket = atoi(inherited);
+		int listening = 0;
+		socklen_t size = sizeof(listening);
+		unsetenv(listenFdVariable);
+		if (!getsockopt(serverSocket, SOL_SOCKET, SO_ACCEPTCONN, &listening,
+				&size) && listening)
+			return serverSocket;
+		printf("Inherited socket %s is not listening\n", inherited);
+	}
+
+	/* prepare server socket */
+	struct sockaddr_in serverAddr;
+	memset(&serverAddr, 0, sizeof(serverAddr));
+	serverAddr.sin_family = AF_INET;
+	serverAddr.sin_port = htons(params->port);
+	serverAddr.sin_addr.s_addr = INADDR_ANY;
+	int serverSocket = socket(PF_INET,SOCK_STREAM, 0);
+	assert(serverSocket != -1, "Couldn't create socket\n");
+
+	/* let the system reuse this socket right after its closing */
+	int optval = 1;
+	setsockopt(serverSocket, SOL_SOCKET,SO_REUSEADDR, &optval, sizeof(optval));
+
+	/* bind the socket */
+	int bindStatus = bind(serverSocket, (const struct sockaddr *) &serverAddr,
+			sizeof(serverAddr));
+	assert(bindStatus != -1, "Binding of the socket failed\n");
+
+	/* start listening on the socket */
+	int listenStatus = listen(serverSocket, params->backlog);
+	assert(listenStatus != -1, "Listening on the socket failed\n");
+
+	/* old and new server both wait for connections during an upgrade, and
+	 * only one of them gets each */
+	fcntl(serverSocket, F_SETFL, O_NONBLOCK);
+	return serverSocket;
+}
+
+/**
+ * Replaces the I/O process with the server binary found under the same name,
+ * e.g. a new build. It inherits the listening socket, so connections keep
+ * being queued meanwhile, and tells the networking process of this server to
+ * finish its requests and exit, which it then reaps along with those of
+ * earlier servers still draining
+ * @param argv Command line the server was started with
+ * @param serverSocket Listening socket
+ * @param networking Networking process of this server
+ * @param predecessors Networking processes of earlier servers still draining
+ * @param count Number of the processes, less than maxPredecessors
+ */
+void upgrade(char* argv[], int serverSocket, pid_t networking,
+		const pid_t *predecessors, int count) {
+	char value[16 * (maxPredecessors + 1)];
+	sprintf(value, "%d", serverSocket);
+	setenv(listenFdVariable, value, true);
+	int length = sprintf(value, "%d", networking);
+	int i;
+	for (i = 0; i < count; ++i)
+		length += sprintf(&value[length], ",%d", predecessors[i]);
+	setenv(predecessorVariable, value, true);
+	fcntl(serverSocket, F_SETFD, 0);
+
+	printf("Upgrading server...\n");
+	fflush(stdout);
+	execvp(argv[0], argv);
+
+	/* the old server goes on */
+	printf("Couldn't start %s: %s\n", argv[0], strerror(errno));
+	unsetenv(listenFdVariable);
+	unsetenv(predecessorVariable);
+}
+
+/**
+ * Reaps networking processes of upgraded servers which finished draining.
+ * They are children of the I/O process, whose pid survives upgrades
+ * @param predecessors Processes still draining, finished ones are removed
+ * @param count Number of the processes
+ * @return Number of processes still draining
+ */
+int reapPredecessors(pid_t *predecessors, int count) {
+	int i, left = 0;
+	for (i = 0; i < count; ++i)
+		if (waitpid(predecessors[i], 0, WNOHANG))
+			printf("Old server %d finished\n", predecessors[i]);
+		else
+			predecessors[left++] = predecessors[i];
+	fflush(stdout);
+	return left;
+}
+
+/**
+ * Stops networking processes, the current one and those of upgraded servers
+ * still draining. Each terminates requests not finished within the stop
+ * timeout; a process which doesn't exit shortly after is killed, so stopping
+ * never takes much longer than the timeout
+ * @param networking Processes to stop
+ * @param count Number of the processes
+ * @param timeout Stop timeout, in seconds
+ * @return Number of processes which didn't exit cleanly
+ */
+int stopServers(const pid_t *networking, int count, int timeout) {
+	char running[count];
+	int i, left = count, errors = 0;
+	for (i = 0; i < count; ++i) {
+		kill(networking[i], SIGUSR1);
+		running[i] = true;
+	}
+
+	long long deadline = nowMicros() + (timeout + stopGrace) * 1000000LL;
+	while (left > 0) {
+		int killed = nowMicros() >= deadline;
+		for (i = 0; i < count; ++i) {
+			int status = 0;
+			if (!running[i])
+				continue;
+			if (killed)
+				kill(networking[i], SIGKILL);
+			if (!waitpid(networking[i], &status, killed ? 0 : WNOHANG))
+				continue;
+			running[i] = false;
+			--left;
+			if (killed || !WIFEXITED(status) || WEXITSTATUS(status))
+				++errors;
+		}
+		usleep(10000);
+	}
+	return errors;
+}
+
+/**
+ * Replaces configuration with a new snapshot read from the file. Processes
+ * serving requests were forked with the old snapshot and keep it until they
+ * finish, while processes forked afterwards see the new one, so the old
+ * snapshot can be freed here at once and requests never take a lock. If the
+ * file can't be read, has invalid lines or memory runs out, the old
+ * snapshot stays, as realms missing from a partial file would leave their
+ * URIs unprotected
+ * @param argc Number of command line arguments
+ * @param argv Command line arguments, which take precedence again
+ */
+void reloadConfig(int argc, char* argv[]) {
+	Config *old = config;
+	int errors;
+	Config *fresh = loadConfig("config", old->generation + 1, argc, argv,
+			&errors);
+	if (!fresh || errors) {
+		if (fresh)
+			freeConfig(fresh);
+		printf("Configuration not reloaded\n");
+		fflush(stdout);
+		return;
+	}
+	const Params *params = &fresh->params;
+
+	/* the socket and shared memory are sized once */
+	if (params->port != old->params.port || params->backlog
+			!= old->params.backlog || params->maxConnections
+			!= old->params.maxConnections || params->authCacheSize
+			!= old->params.authCacheSize || params->appendLogSize
+			!= old->params.appendLogSize || params->appendDurability
+			!= old->params.appendDurability || params->appendSyncInterval
+			!= old->params.appendSyncInterval)
+		printf("Listening socket and shared memory change only on restart\n");
+	if (compressInit(stats, params->gzipCacheDir, params->gzipLevel,
+			params->gzipMinLength, params->gzipMaxLength,
+			params->gzipCacheSize))
+		printf("Couldn't create %s, responses won't be compressed\n",
+				params->gzipCacheDir);
+
+	/* realm indices of verified credentials refer to the old snapshot */
+	authCacheClear(authCache);
+	config = fresh;
+	freeConfig(old);
+	printf("Configuration reloaded, %d realms\n", config->realmCount);
+	fflush(stdout);
+}
+
 /*
  * main()
  */
 int main(int argc, char* argv[]) {
-	/* parse configuration file */
-	FILE *file = fopen("config", "r");
-	if (file) {
-		char line[256];
-		int isRealm = false;
-		while (!feof(file)) {
-			if (!fgets(line, sizeof(line), file))
-				break;
-			int i;
-			/* line starting new realm is like: [%s] */
-			if (line[0] == '[' && line[strlen(line) - 1 == ']']) {
-				for (i = 1; i < strlen(line) - 2; ++i)
-					realm[realmCount].name[i - 1] = line[i];
-				realm[realmCount].name[i - 1] = 0;
-				isRealm = true;
-				realm[realmCount].count = 0;
-				/* line with login is like: login=%s */
-			} else if (isRealm && !(strncmp(line, "login=", 6))) {
-				for (i = 6; i < strlen(line) - 1; ++i)
-					realm[realmCount].login[i - 6] = line[i];
-				realm[realmCount].login[i - 6] = 0;
-				/* line with password is like: pass=%s */
-			} else if (isRealm && !(strncmp(line, "pass=", 5))) {
-				for (i = 5; i < strlen(line) - 1; ++i)
-					realm[realmCount].pass[i - 5] = line[i];
-				realm[realmCount].pass[i - 5] = 0;
-				/* lines with URIs are like: uri=%s */
-			} else if (isRealm && !(strncmp(line, "uri=", 4))) {
-				for (i = 4; i < strlen(line) - 1; ++i)
-					realm[realmCount].uri[realm[realmCount].count][i - 4]
-							= line[i];
-				realm[realmCount].uri[realm[realmCount].count++][i - 4] = 0;
-				/* empty line finishes one realm configuration */
-			} else if (line[0] == '\n') {
-				++realmCount;
-				isRealm = false;
-			}
-		}
-		++realmCount;
-		fclose(file);
-	}
+	/* parse configuration file; parameters on command line take precedence */
+	int errors;
+	config = loadConfig("config", 1, argc, argv, &errors);
+	assert(config != 0, "Couldn't load configuration\n");
+	const Params *params = &config->params;
 
 	/* shared memory block to store server state */
-	int shmId = shmget(10, sizeof(int), 0666 | IPC_CREAT);
-	assert(shmId != -1, "Couldn't create shared memory buffer\n");
+	char *serverState = (char*) sharedAlloc(sizeof(int));
+	assert(serverState != 0, "Couldn't create shared memory buffer\n");
+	*serverState = running;
+
+	/* statistics updated by every process */
+	stats = statsCreate();
+	fsInit(stats);
+	if (compressInit(stats, params->gzipCacheDir, params->gzipLevel,
+			params->gzipMinLength, params->gzipMaxLength,
+			params->gzipCacheSize))
+		printf("Couldn't create %s, responses won't be compressed\n",
+				params->gzipCacheDir);
+
+	/* the listening socket outlives processes of the server during upgrades;
+	 * the server being upgraded is told to drain once this one runs */
+	int serverSocket = openListener(params);
+	pid_t predecessors[maxPredecessors];
+	int predecessorCount = 0;
+	const char *predecessorValue = getenv(predecessorVariable);
+	while (predecessorValue && *predecessorValue && predecessorCount
+			< maxPredecessors) {
+		char *end;
+		predecessors[predecessorCount++] = strtol(predecessorValue, &end, 10);
+		predecessorValue = *end == ',' ? end + 1 : 0;
+	}
+	unsetenv(predecessorVariable);
+
+	/* "reload" command and SIGHUP reload configuration; select() is
+	 * interrupted, so the networking process reloads immediately */
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = requestReload;
+	sigaction(SIGHUP, &action, 0);
 
 	/* fork here, one process to handle I/O, one to process networking */
 	int childId = fork();
@@ -637,192 +1468,213 @@ int main(int argc, char* argv[]) {
 	/* *************************************************************************
 	 * I/O process */
 	if (childId) {
-		char *serverState = (char*) shmat(shmId, 0, 0);
+		networkingProcess = childId;
+		action.sa_handler = forwardReload;
+		action.sa_flags = SA_RESTART;
+		sigaction(SIGHUP, &action, 0);
+		if (predecessorCount) {
+			/* the last upgraded server starts draining, earlier ones go on */
+			kill(predecessors[0], SIGTERM);
+			printf("Server upgraded\n");
+			fflush(stdout);
+		}
 		while (1) {
 			char command[maxCommandLength];
 			scanf("%s", command);
 
+			/* old networking processes are our children since the upgrade */
+			predecessorCount = reapPredecessors(predecessors,
+					predecessorCount);
+
 			/* "stop" command */
 			if (!strcmp(command, "stop")) {
 				printf("Stopping server... please wait\n");
+				fflush(stdout);
 				*serverState = stopped;
-
-				int stopRes;
-				waitpid(childId, &stopRes, 0);
-
-				if (stopRes)
+				/* this process holds the listening socket too, connections
+				 * would be queued until it exits */
+				close(serverSocket);
+				/* the networking processes are woken up at once; the stop
+				 * timeout of the snapshot loaded at start bounds the wait */
+				pid_t networking[maxPredecessors + 1];
+				networking[0] = childId;
+				memcpy(&networking[1], predecessors, predecessorCount
+						* sizeof(pid_t));
+				if (stopServers(networking, predecessorCount + 1,
+						params->stopTimeout))
 					printf("There were some errors while stopping the server\n");
 				else
 					printf("Server stopped successfully\n");
 				fflush(stdout);
 
 				shmdt(serverState);
-				shmctl(shmId, IPC_RMID,0);
 				break;
-			} else
+			} else if (!strcmp(command, "stats"))
+				statsPrint(stats);
+			else if (!strcmp(command, "reload"))
+				kill(childId, SIGHUP);
+			else if (!strcmp(command, "upgrade")) {
+				if (predecessorCount < maxPredecessors)
+					upgrade(argv, serverSocket, childId, predecessors,
+							predecessorCount);
+				else
+					printf("%d old servers still draining, try again later\n",
+							predecessorCount);
+			}
+			else
 				printf("Unknown command\n");
 		}
 		return 0;
 	}
 	/* ********************************************************************** */
-	char *serverState = (char*) shmat(shmId, 0, 0);
-	*serverState = running;
-
-	/* reserve table for information about connected clients */
-	int infoId = shmget(100, sizeof(struct ClientInfo) * maxConnections, 0666
-			| IPC_CREAT);
-	assert(infoId != -1, "Couldn't create shared memory buffer\n");
-
-	/* initialize client array */
-	struct ClientInfo *clients;
-	clients = (struct ClientInfo*) shmat(infoId, 0, 0);
-	int i;
-	for (i = 0; i < maxConnections; i++)
-		clients[i].status = empty;
-
-	/* prepare server socket */
-	struct sockaddr_in serverAddr;
-	memset(&serverAddr, 0, sizeof(serverAddr));
-	serverAddr.sin_family = AF_INET;
-	serverAddr.sin_port = htons(serverPort);
-	serverAddr.sin_addr.s_addr = INADDR_ANY;
-	int serverSocket = socket(PF_INET,SOCK_STREAM, 0);
-	assert(serverSocket != -1, "Couldn't create socket\n");
-
-	/* let the system reuse this socket right after its closing */
-	int optval = 0;
-	setsockopt(serverSocket, SOL_SOCKET,SO_REUSEADDR, &optval, sizeof(optval));
-
-	/* bind the socket */
-	int bindStatus = bind(serverSocket, (const struct sockaddr *) &serverAddr,
-			sizeof(serverAddr));
-	assert(bindStatus != -1, "Binding of the socket failed\n");
-
-	/* start listening on the socket */
-	int listenStatus = listen(serverSocket, queueSize);
-	assert(listenStatus != -1, "Listening on the socket failed\n");
-
-	int maxSD = serverSocket + 1;
+	action.sa_handler = requestDrain;
+	sigaction(SIGTERM, &action, 0);
+	action.sa_handler = requestStop;
+	sigaction(SIGUSR1, &action, 0);
+
+	/* cache of verified credentials shared by client processes */
+	authCache = authCacheCreate(params->authCacheSize);
+	appendLog = appendLogCreate(params->appendLogSize,
+			params->appendDurability, params->appendSyncInterval, stats);
+
+	/* reserve table for information about connected clients; client
+	 * processes inherit it */
+	ClientTable *clients = clientTableCreate(params->maxConnections);
+	assert(clients != 0, "Couldn't create shared memory buffer\n");
+
+	/* finished clients are reaped as soon as they exit, so their slots are
+	 * free for the next connections */
+	sigset_t childSignal;
+	sigemptyset(&childSignal);
+	sigaddset(&childSignal, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &childSignal, 0);
+	int sigFd = signalfd(-1, &childSignal, SFD_NONBLOCK | SFD_CLOEXEC);
+	assert(sigFd != -1, "Couldn't create signalfd\n");
+
+	int maxSD = serverSocket > sigFd ? serverSocket : sigFd;
 	fd_set fsServer;
 	FD_ZERO(&fsServer);
 
 	struct timeval timeout;
 	/* prepare server timeout */
-	timeout.tv_sec = serverTimeout;
+	timeout.tv_sec = params->serverTimeout;
 	timeout.tv_usec = 0;
 	/* *************************************************************************
 	 * networking process */
-	int clientNumber = 0;
-	while (*serverState == running) {
-		/* select client to connect to */
+	while (*serverState == running && !drainRequested) {
+		if (reloadRequested) {
+			reloadRequested = false;
+			reloadConfig(argc, argv);
+			params = &config->params;
+		}
+
+		/* select client to connect to, or finished clients */
 		FD_SET(serverSocket, &fsServer);
+		FD_SET(sigFd, &fsServer);
 		int foundStatus = select(maxSD + 1, &fsServer, (fd_set*) 0,
 				(fd_set*) 0, &timeout);
 
-		/* count active clients; clean info about stopped clients */
-		if (foundStatus < 0)
-			printf("Select error\n");
-		else if (!foundStatus) {
+		if (foundStatus < 0) {
+			if (errno != EINTR)
+				printf("Select error\n");
+			continue;
+		} else if (!foundStatus) {
 			/* reset server timeout */
-			timeout.tv_sec = serverTimeout;
+			timeout.tv_sec = params->serverTimeout;
 			timeout.tv_usec = 0;
-
-			clientNumber = 0;
-			for (i = 0; i < maxConnections; i++) {
-				if (clients[i].status == working)
-					++clientNumber;
-				else if (clients[i].status == stopped) {
-					clients[i].status = empty;
-					waitpid(clients[i].procid, 0, WNOHANG);
-					close(clients[i].sockd);
-				}
-			}
-			printf("Connected clients: %d\n", clientNumber);
+			printf("Connected clients: %d\n", clients->used);
+			fflush(stdout);
 		}
 
+		/* clean info about stopped clients */
+		if (FD_ISSET(sigFd, &fsServer))
+			reapClients(sigFd, clients);
+
 		/* process new connection */
 		if (FD_ISSET(serverSocket, &fsServer)) {
 			struct sockaddr_in clientAddr;
-			int size = 0;
+			socklen_t size = sizeof(clientAddr);
 			int clientSocket = accept(serverSocket,
-					(struct sockaddr*) &clientAddr, (socklen_t*) &size);
-			assert(clientSocket != -1,
-					"Couldn't create a connection's socket.\n");
-
-			if (clientSocket > maxSD)
-				maxSD = clientSocket;
+					(struct sockaddr*) &clientAddr, &size);
+			/* another server sharing the socket may have taken it */
+			if (clientSocket < 0)
+				continue;
 
-			/* max number of connections reached */
-			if (clientNumber == maxConnections) {
+			/* add this new connection to the table, unless it is full */
+			int i = clientSlotAcquire(clients);
+			if (i < 0) {
 				printf("Too many connections\n");
+				fflush(stdout);
 				close(clientSocket);
 				continue;
 			}
-			clientNumber++;
+			clients->slot[i].sockd = clientSocket;
+			memcpy(&clients->slot[i].clientData, &clientAddr, size);
 
-			/* add this new connection to array */
-			for (i = 0; i < maxConnections; i++)
-				if (clients[i].status == empty)
-					break;
-			clients[i].status = new;
-			clients[i].sockd = clientSocket;
-			memcpy(&clients[i].clientData, &clientAddr, size);
-
-			/* fork here to create process communicating with new client */
+			/* fork here to create process communicating with new client;
+			 * output buffered so far would be written by the child again */
+			fflush(stdout);
 			int pid = fork();
 			if (!pid) {
-				struct ClientInfo *myInfo;
-				myInfo = shmat(infoId, 0, 0);
-				myInfo[i].status = working;
+				clientSlotSetStatus(clients, i, new, working);
+				/* the request is served with the configuration it came with */
+				signal(SIGHUP, SIG_IGN);
+				signal(SIGTERM, SIG_DFL);
+				close(sigFd);
+				/* a draining server must stop queueing connections even while
+				 * this request goes on */
+				close(serverSocket);
+				sigprocmask(SIG_UNBLOCK, &childSignal, 0);
 
 				/* *************************************************************/
 				/* communication process */
 				int exitRes = 0;
 
+				/* a silent client doesn't hold its process forever */
+				struct timeval clientTimeout = { params->clientTimeout, 0 };
+				setsockopt(clientSocket, SOL_SOCKET, SO_RCVTIMEO,
+						&clientTimeout, sizeof(clientTimeout));
+
 				/* read the socket */
 				struct bstrList *tempList = getRequest(clientSocket);
 				int responseSize;
 				char *response = createResponse(tempList, &responseSize,
 						clientSocket);
-				write(clientSocket, response, responseSize);
-				free(response);
+				/* responses sent directly from files are already written */
+				if (response) {
+					writeAll(clientSocket, response, responseSize);
+					free(response);
+				}
 				bstrListDestroy(tempList);
 
 				/* ************************************************************/
 
-				myInfo[i].status = stopped;
-				shmdt(myInfo);
+				/* the slot is freed once the process is reaped */
+				clientSlotSetStatus(clients, i, working, finished);
 				exit(exitRes);
 			}
-			clients[i].procid = pid;
-		}
-	}
-	/* ************************************************************************/
-
-	/* cleaning client data */
-	if (clientNumber > 0) {
-		char msg[20];
-		for (i = 0; i < maxConnections; i++) {
-			if (clients[i].status == working) {
-
-				sprintf(msg, "kill -9 %d", clients[i].procid);
-
-				printf("%s\n", msg);
-				system((const char*) msg);
-			}
-			clients[i].status = finished;
 
+			/* the connection is closed once the client process exits */
+			close(clientSocket);
+			if (pid < 0)
+				clientSlotRelease(clients, i);
+			else
+				clientSlotAssign(clients, i, pid);
 		}
-
-		for (i = 0; i < maxConnections; i++)
-			close(clients[i].sockd);
 	}
+	/* ************************************************************************/
 
-	/* close socket and free shared memory */
+	/* no new connections; after an upgrade the new server accepts them,
+	 * requests in progress are served to the end unless stopping */
 	close(serverSocket);
+	if (*serverState == stopped)
+		stopRequested = true;
+	drainClients(clients, params->stopTimeout);
+	close(sigFd);
+
+	/* free shared memory */
 	shmdt(clients);
 	shmdt(serverState);
-	shmctl(infoId, IPC_RMID,0);
 
 	return 0;
 }
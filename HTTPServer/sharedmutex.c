@@ -0,0 +1,40 @@
+#include "headers.h"
+#include "structures.h"
+#include "prototypes.h"
+
+/*!
+ * Allocates zeroed memory shared with every process forked afterwards. The
+ * segment goes away when the last process detaches it
+ * @param size Number of bytes needed
+ * @return Pointer to the memory, 0 if shared memory could not be created
+ */
+void* sharedAlloc(size_t size) {
+	int shmId = shmget(IPC_PRIVATE, size, 0600 | IPC_CREAT);
+	if (shmId == -1)
+		return 0;
+	void *memory = shmat(shmId, 0, 0);
+	shmctl(shmId, IPC_RMID, 0);
+	if (memory == (void*) -1)
+		return 0;
+	memset(memory, 0, size);
+	return memory;
+}
+
+/*!
+ * Initializes a mutex placed in shared memory, so that it is used by every
+ * process forked afterwards. The mutex is robust: if its holder dies, e.g.
+ * killed at the stop deadline, the next process locking it gets EOWNERDEAD
+ * instead of waiting forever, and has to call pthread_mutex_consistent()
+ * @param mutex Mutex to initialize
+ * @return 0 on success, -1 on failure
+ */
+int initSharedMutex(pthread_mutex_t *mutex) {
+	pthread_mutexattr_t attr;
+	if (pthread_mutexattr_init(&attr))
+		return -1;
+	int result = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED)
+			|| pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST)
+			|| pthread_mutex_init(mutex, &attr) ? -1 : 0;
+	pthread_mutexattr_destroy(&attr);
+	return result;
+}
@@ -0,0 +1,82 @@
+#include "headers.h"
+#include "structures.h"
+#include "prototypes.h"
+
+/*!
+ * Creates server statistics in shared memory, so that every process forked
+ * afterwards updates the same counters
+ * @return Pointer to zeroed statistics, 0 if shared memory could not be created
+ */
+Stats* statsCreate() {
+	return (Stats*) sharedAlloc(sizeof(Stats));
+}
+
+/*!
+ * Adds one measurement to a histogram
+ * @param histogram Histogram to update
+ * @param micros Measured time in microseconds
+ */
+void histogramRecord(Histogram *histogram, long long micros) {
+	int bucket = 0;
+	while (bucket < histogramBuckets - 1 && micros >= (1LL << bucket))
+		++bucket;
+	__sync_fetch_and_add(&histogram->bucket[bucket], 1);
+	__sync_fetch_and_add(&histogram->count, 1);
+}
+
+/*!
+ * Estimates a percentile of measurements stored in a histogram
+ * @param histogram Histogram to read
+ * @param percent Requested percentile, e.g. 99
+ * @return Upper bound of the percentile in microseconds, 0 if nothing was measured
+ */
+long long histogramPercentile(const Histogram *histogram, int percent) {
+	unsigned long count = histogram->count;
+	if (!count)
+		return 0;
+	unsigned long wanted = (count * percent + 99) / 100;
+	unsigned long seen = 0;
+	int bucket;
+	for (bucket = 0; bucket < histogramBuckets - 1; ++bucket) {
+		seen += histogram->bucket[bucket];
+		if (seen >= wanted)
+			break;
+	}
+	return 1LL << bucket;
+}
+
+/*!
+ * Prints one histogram in a single line
+ * @param name Name of the measurement
+ * @param histogram Histogram to print
+ */
+static void histogramPrint(const char *name, const Histogram *histogram) {
+	printf("%s: %lu, p50 <= %lld us, p99 <= %lld us\n", name,
+			histogram->count, histogramPercentile(histogram, 50),
+			histogramPercentile(histogram, 99));
+}
+
+/*!
+ * Prints all statistics on standard output
+ * @param stats Statistics to print
+ */
+void statsPrint(const Stats *stats) {
+	if (!stats)
+		return;
+	histogramPrint("Password checks", &stats->authLatency);
+	printf("Appends: %lu lines, %lu bytes, %lu syncs\n", stats->appends,
+			stats->appendBytes, stats->appendSyncs);
+	histogramPrint("Durable appends", &stats->appendCommit);
+	printf("Filesystem operations in progress: %lu, at most %lu\n",
+			stats->fsPending, stats->fsPendingPeak);
+	histogramPrint("File opens", &stats->fsLatency[fsOpOpen]);
+	histogramPrint("File stats", &stats->fsLatency[fsOpStat]);
+	histogramPrint("Directory scans", &stats->fsLatency[fsOpScan]);
+	histogramPrint("File writes", &stats->fsLatency[fsOpWrite]);
+	printf("Compression: %lu files, %lu cache hits, %lu -> %lu bytes (%.1f%%), "
+		"%lu ms CPU\n", stats->compressions, stats->compressHits,
+			stats->compressedIn, stats->compressedOut, stats->compressedIn
+					? 100.0 * stats->compressedOut / stats->compressedIn : 0,
+			stats->compressCpu / 1000);
+	fflush(stdout);
+}
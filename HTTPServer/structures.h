@@ -18,6 +18,27 @@ enum HTTPVersion {
 	http_1_1
 };
 
+/* possible server status codes */
+enum codes {
+	ok,
+	created,
+	accepted,
+	noContent,
+	partialContent,
+	movedPermanently,
+	movedTemporarily,
+	notModified,
+	badRequest,
+	unauthorized,
+	forbidden,
+	notFound,
+	rangeNotSatisfiable,
+	internalServerError,
+	notImplemented,
+	badGateway,
+	serviceUnavailable
+};
+
 /* possible client status */
 enum ClientStatus {
 	empty, /// server has a free unit to process client
@@ -27,15 +48,280 @@ enum ClientStatus {
 /// finished exchanging messages
 };
 
-/* realms for authentication */
+/* block of memory owned by an arena */
+typedef struct ArenaBlock {
+	struct ArenaBlock *next; /// previously allocated block
+	size_t size; /// size of the block including this header
+	size_t used; /// bytes already given away
+} ArenaBlock;
+
+/* memory arena, freed all at once */
+typedef struct Arena {
+	ArenaBlock *block; /// block which new allocations come from
+} Arena;
+
+/* realms for authentication; protected URIs are kept in a RealmNode trie */
 typedef struct Realm {
-	char name[256];
-	char login[256];
-	char pass[256];
-	char uri[256][256];
-	int count;
+	char *name;
+	char *login;
+	char *pass;
 } Realm;
 
+/* node of a radix trie which maps protected URIs to realms */
+typedef struct RealmNode {
+	char *label; /// part of URI on the edge leading to this node
+	int labelLen; /// length of the label
+	int exact; /// realm protecting exactly this URI, -1 if none
+	int prefix; /// realm protecting every URI starting here, -1 if none
+	struct RealmNode *child; /// first child node
+	struct RealmNode *next; /// next sibling node
+} RealmNode;
+
+/* when appended lines are synced to disk */
+enum Durability {
+	durabilityNone, /// never, left to the kernel
+	durabilityInterval, /// appends to a file share a sync at most every interval
+	durabilityRequest /// every append is synced before the response
+};
+
+/* runtime parameters, given at the top of configuration file or on command
+ * line; sizes are in bytes and times in seconds unless noted otherwise */
+typedef struct Params {
+	int port; /// port the server listens on
+	int backlog; /// connections waiting to be accepted
+	int maxConnections; /// clients served at once, each by its own process
+	int serverTimeout; /// time between checks of finished clients
+	int clientTimeout; /// time a client may stay silent
+	int stopTimeout; /// time requests in progress may take after "stop"
+	int requestBufferSize; /// longest piece of request head read at once
+	int maxRequestLength; /// longest request head
+	int uploadChunkSize; /// size of chunks uploaded files are copied in
+	long long maxFormLength; /// longest form sent with POST
+	long long maxFieldLength; /// longest field of a form
+	long long maxFilePartLength; /// longest file sent in a form
+	long long maxMultipartLength; /// longest multipart/form-data body
+	enum Durability appendDurability; /// when appended phrases are synced
+	int appendSyncInterval; /// shortest time between syncs, in milliseconds
+	int appendLogSize; /// files tracked for group commit
+	int authCacheSize; /// cached verified credentials
+	int authCacheTTL; /// time credentials stay verified
+	int maxRanges; /// most ranges served in one response
+	int rangeCoalesceGap; /// ranges closer than this are sent as one
+	const char *gzipCacheDir; /// compressed files, outside of the served tree
+	int gzipLevel; /// compression level, 1 to 9
+	int gzipMinLength; /// shorter files are not compressed
+	long long gzipMaxLength; /// longer files are compressed while sent, not cached
+	long long gzipCacheSize; /// largest total size of cached compressed files
+} Params;
+
+/* types of runtime parameters */
+enum ParamType {
+	paramInt, paramLong, paramString, paramDurability
+};
+
+/* description of a runtime parameter */
+typedef struct ParamInfo {
+	const char *name; /// name used in key=value
+	enum ParamType type; /// type of the value
+	size_t offset; /// offset of the value in Params
+	long long min; /// smallest numeric value accepted
+	long long max; /// largest numeric value accepted
+} ParamInfo;
+
+/* configuration read from file, read-only once loaded */
+typedef struct Config {
+	Arena arena; /// memory holding everything below
+	Realm *realm; /// configured realms
+	int realmCount; /// number of realms
+	RealmNode *realmTrie; /// URIs of all realms
+	Params params; /// runtime parameters
+	int generation; /// number of the snapshot, counted from 1 on every reload
+} Config;
+
+/* Authorization header value verified for a realm */
+typedef struct AuthCacheEntry {
+	int generation; /// configuration snapshot the entry was verified under, 0 if free
+	unsigned int hash; /// hash of the header value
+	int realm; /// index of the realm
+	time_t expires; /// time after which the value has to be verified again
+	int len; /// length of the header value
+	char credentials[128]; /// raw header value
+} AuthCacheEntry;
+
+/* cache of verified credentials, shared by all processes */
+typedef struct AuthCache {
+	pthread_mutex_t lock; /// robust mutex guarding the entries
+	int size; /// number of entries
+	AuthCacheEntry entry[]; /// cached verifications
+} AuthCache;
+
+/* latency histogram; bucket i counts measurements below 2^i microseconds */
+enum {
+	histogramBuckets = 32
+};
+typedef struct Histogram {
+	unsigned long count; /// number of measurements
+	unsigned long bucket[histogramBuckets]; /// measurements per bucket
+} Histogram;
+
+/* kinds of measured filesystem operations */
+enum FsOp {
+	fsOpOpen, fsOpStat, fsOpScan, fsOpWrite, fsOpCount
+};
+
+/* server statistics, shared by all processes */
+typedef struct Stats {
+	Histogram authLatency; /// time spent verifying credentials
+	unsigned long appends; /// lines appended to files
+	unsigned long appendBytes; /// bytes appended to files
+	unsigned long appendSyncs; /// syncs of appended files
+	Histogram appendCommit; /// time from an append until it is durable
+	Histogram fsLatency[fsOpCount]; /// time spent in filesystem operations
+	unsigned long fsPending; /// filesystem operations in progress
+	unsigned long fsPendingPeak; /// most operations ever in progress at once
+	unsigned long compressions; /// files compressed for sending
+	unsigned long compressHits; /// compressed files found in the cache
+	unsigned long compressedIn; /// bytes of files compressed
+	unsigned long compressedOut; /// bytes of compressed files
+	unsigned long compressCpu; /// CPU time spent compressing, in microseconds
+} Stats;
+
+/* appends to one file, for group commit */
+typedef struct AppendFile {
+	dev_t dev; /// device of the file
+	ino_t ino; /// inode of the file, 0 if the slot is free
+	unsigned long writeSeq; /// number of appends written
+	unsigned long syncedSeq; /// number of appends known to be on disk
+	long long syncStart; /// when the running sync started, 0 if none
+	long long lastSync; /// when the last sync finished
+	int waiters; /// processes waiting for a sync, the slot is kept while any
+} AppendFile;
+
+/* files being appended to, in shared memory */
+typedef struct AppendLog {
+	pthread_mutex_t lock; /// robust mutex guarding the files
+	enum Durability durability; /// when appends are synced
+	long long interval; /// shortest time between syncs of a file, in microseconds
+	int size; /// number of slots
+	Stats *stats; /// statistics to update, may be 0
+	AppendFile file[]; /// files appended to recently
+} AppendLog;
+
+enum {
+	appendBufferSize = 64 * 1024
+};
+
+/* line being appended to a file */
+typedef struct AppendWriter {
+	AppendLog *log; /// group commit state, 0 to append without syncing
+	Stats *stats; /// statistics to update, may be 0
+	int fd; /// file opened with O_APPEND
+	int length; /// bytes staged in buffer
+	int error; /// set once a write failed
+	int spool; /// temporary file holding a line longer than the buffer, -1 if none
+	char buffer[appendBufferSize]; /// staged part of the line
+} AppendWriter;
+
+/* function receiving decoded form values piece by piece */
+typedef void (*FormCallback)(void *context, const char *name,
+		const char *value, int len, int last);
+
+/* streaming parser of application/x-www-form-urlencoded data */
+typedef struct FormParser {
+	char name[256]; /// decoded name of current field
+	int nameLength; /// length of the name
+	int inValue; /// whether the name is complete and a value is being parsed
+	int escape; /// number of characters of a %XX escape seen, 0 if none
+	int escapeValue; /// value of the escape decoded so far
+	long valueLength; /// decoded length of current value
+	long length; /// encoded length of the form parsed so far
+	long maxValueLength; /// longest value accepted
+	long maxLength; /// longest form accepted
+	int error; /// set once the form turned out to be malformed
+	FormCallback onField; /// receives values
+	void *context; /// passed to onField
+} FormParser;
+
+/* position of a decoder in a body with chunked transfer coding */
+enum ChunkState {
+	chunkStateSize, chunkStateExtension, chunkStateData, chunkStateDataEnd,
+	chunkStateTrailer, chunkStateTrailerLine, chunkStateDone
+};
+
+/* range of a file sent in a request */
+typedef struct ContentRange {
+	long long first; /// offset of the first byte
+	long long last; /// offset of the last byte
+	long long total; /// length of the whole file
+} ContentRange;
+
+/* request body being read from a socket */
+typedef struct BodyReader {
+	int sockd; /// socket the request came from
+	long long remaining; /// bytes of the body, or of current chunk, not read yet
+	int chunked; /// set if the body has chunked transfer coding
+	enum ChunkState state; /// position in a chunked body
+	int digits; /// digits of chunk size read so far
+} BodyReader;
+
+/* position of a parser in a multipart/form-data body */
+enum MultipartState {
+	multipartPreamble, multipartDelimiter, multipartHeaders, multipartBody,
+	multipartDone
+};
+
+/* function told about a new part; filename is 0 for plain fields.
+ * Returns 0 to go on, -1 to stop parsing */
+typedef int (*PartCallback)(void *context, const char *name,
+		const char *filename);
+
+enum {
+	multipartBufferSize = 64 * 1024
+};
+
+/* streaming parser of multipart/form-data bodies */
+typedef struct MultipartParser {
+	char delimiter[76]; /// CRLF, "--" and the boundary
+	int delimiterLength; /// length of the delimiter
+	unsigned char skip[256]; /// Boyer-Moore-Horspool shifts for the delimiter
+	enum MultipartState state; /// current position in the body
+	char header[2048]; /// headers of current part
+	int headerLength; /// length of the headers gathered so far
+	char name[256]; /// name of current part
+	char filename[256]; /// file name of current part
+	int isFile; /// whether current part has a file name
+	long long partLength; /// length of current part so far
+	long long length; /// length of the body so far
+	long long maxFieldLength; /// longest plain field accepted
+	long long maxPartLength; /// longest file accepted
+	long long maxLength; /// longest body accepted
+	int error; /// set once the body turned out to be malformed
+	PartCallback onPart; /// told about every part
+	FormCallback onData; /// receives contents of parts
+	void *context; /// passed to the callbacks
+	int carry; /// bytes at the start of buffer left from previous input
+	char buffer[multipartBufferSize]; /// input, read here by the caller
+} MultipartParser;
+
+/* state of a POST request which appends a phrase to a file */
+typedef struct PostRequest {
+	char filename[256]; /// name of the file, gathered piece by piece
+	int filenameLength; /// length of the name
+	int fd; /// the file, -1 until its name is known
+	AppendWriter append; /// writer of the phrase
+	int saved; /// whether a whole phrase was saved
+	int error; /// set on malformed request or failed write
+	int denied; /// set when a named file is in a realm not authorized for
+	bstring authorization; /// Authorization header line, 0 if not sent
+	const char *directory; /// where files sent as multipart/form-data go
+	int directoryLength; /// length of the directory
+	int inFile; /// whether the current part is a file
+	int partFd; /// temporary file of current file part, -1 if skipped
+	char *partTemp; /// name of the temporary file
+	char partPath[512]; /// path the file part is stored under
+	bstring stored; /// paths of stored files, one per line
+} PostRequest;
+
 /* possible server status */
 enum ServerStatus {
 	running, stopped
@@ -45,10 +331,21 @@ enum ServerStatus {
  * Structure to store information about each connected client
  */
 typedef struct ClientInfo {
-	enum ClientStatus status; /// connection status
+	volatile enum ClientStatus status; /// connection status, changed atomically
 	int sockd; /// socket descriptor
 	int procid; /// id of a process that communicates with client
 	struct sockaddr_in clientData; /// client address information
+	int next; /// next slot on the free list, -1 at its end
 } ClientInfo;
 
+/* connected clients, in shared memory; free slots form a lock-free stack */
+typedef struct ClientTable {
+	volatile unsigned long long freeHead; /// first free slot in low 32 bits, ABA tag in high 32 bits
+	volatile int used; /// number of slots taken
+	int size; /// number of slots
+	int *byPid; /// open addressing hash of slot index + 1 by process id, 0 if empty
+	unsigned int byPidMask; /// size of the hash minus one, the size is a power of two
+	ClientInfo slot[]; /// slots, followed by the hash
+} ClientTable;
+
 #endif /* structures_h */
@@ -10,8 +10,8 @@ void parseDate(const char *buffer, struct tm *date) {
 
 	int len;
 
-	char firstElement[20];
-	sscanf(buffer, "%s", firstElement);
+	char firstElement[20] = "";
+	sscanf(buffer, "%19s", firstElement);
 	len = strlen(firstElement);
 
 	switch (len) {
@@ -99,3 +99,45 @@ int compareDates(const struct tm *date1, const struct tm *date2) {
 	return (sec2 - sec1);
 }
 
+
+/*!
+ * Converts a date sent in a header to a time
+ * @param buffer Date in one of the forms accepted by parseDate()
+ * @return Number of seconds since the Epoch, -1 if buffer is not a date
+ */
+time_t parseHttpDate(const char *buffer) {
+	/* If-Range may carry an entity tag instead of a date */
+	if (buffer[0] == '"' || !strncmp(buffer, "W/", 2))
+		return -1;
+
+	struct tm date;
+	memset(&date, 0, sizeof(date));
+	parseDate(buffer, &date);
+	/* strptime() leaves the day of month at 0 if it fails */
+	if (!date.tm_mday)
+		return -1;
+	return timegm(&date);
+}
+
+/*!
+ * Converts a time to an RFC-1123 date, as used in Last-Modified header
+ * @param buffer Pointer to memory where the date will be saved
+ * @param size Size of the buffer
+ * @param time Number of seconds since the Epoch
+ * @return Length of the date
+ */
+int httpDateToStr(char *buffer, int size, time_t time) {
+	struct tm date;
+	gmtime_r(&time, &date);
+	return strftime(buffer, size, "%a, %d %b %Y %T GMT", &date);
+}
+
+/*!
+ * Reads a monotonic clock, suitable for measuring durations
+ * @return Number of microseconds since an unspecified point in the past
+ */
+long long nowMicros() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,310 @@
+#include "headers.h"
+#include "structures.h"
+#include "prototypes.h"
+
+/*!
+ * Checks whether a path of uploaded file is safe to write to
+ * @param path Path relative to the server directory
+ * @return true if the path names a file inside the server directory
+ */
+int isUploadPathValid(const char *path) {
+	int len = strlen(path);
+	if (!len || path[0] == '/' || path[len - 1] == '/')
+		return false;
+
+	/* reject ".." as any component of the path */
+	const char *component = path;
+	while (component) {
+		if (!strncmp(component, "..", 2) && (component[2] == '/'
+				|| !component[2]))
+			return false;
+		component = strchr(component, '/');
+		if (component)
+			++component;
+	}
+	return true;
+}
+
+/*!
+ * Moves a request body from the socket to a file with splice(), through a
+ * pipe, so the data never enters user space
+ * @param fd File to write to
+ * @param body Reader of the request body
+ * @param chunkSize Largest amount of data moved at once
+ * @return ok when the whole body is in the file, notImplemented if splice()
+ * can't be used for this socket or file (data moved so far is already in the
+ * file and the rest is left in the socket), badRequest if the body was
+ * truncated, internalServerError on write failure
+ */
+static enum codes spliceUpload(int fd, BodyReader *body, int chunkSize) {
+	/* chunked bodies have to be decoded in user space */
+	int pipeFd[2];
+	if (body->chunked || pipe(pipeFd))
+		return notImplemented;
+	fcntl(pipeFd[1], F_SETPIPE_SZ, chunkSize);
+
+	enum codes result = ok;
+	while (result == ok && body->remaining > 0) {
+		long size = chunkSize < body->remaining ? chunkSize : body->remaining;
+		long moved = splice(body->sockd, 0, pipeFd[1], 0, size, SPLICE_F_MOVE
+				| SPLICE_F_MORE);
+		if (moved < 0 && errno == EINTR)
+			continue;
+		if (moved < 0 && (errno == EINVAL || errno == ENOSYS))
+			result = notImplemented;
+		else if (moved <= 0)
+			result = badRequest;
+		if (result != ok)
+			break;
+		body->remaining -= moved;
+
+		/* empty the pipe into the file */
+		while (moved > 0) {
+			long written = splice(pipeFd[0], 0, fd, 0, moved, SPLICE_F_MOVE);
+			if (written < 0 && errno == EINTR)
+				continue;
+			if (written > 0) {
+				moved -= written;
+				continue;
+			}
+			if (written < 0 && (errno == EINVAL || errno == ENOSYS)) {
+				/* the file can't be spliced to, copy what is in the pipe */
+				char *buffer = (char*) malloc(moved);
+				if (read(pipeFd[0], buffer, moved) != moved || writeAll(fd,
+						buffer, moved))
+					result = internalServerError;
+				else
+					result = notImplemented;
+				free(buffer);
+			} else
+				result = internalServerError;
+			break;
+		}
+	}
+
+	close(pipeFd[0]);
+	close(pipeFd[1]);
+	return result;
+}
+
+/*!
+ * Creates a temporary file next to the target of an upload
+ * @param path Path of the target relative to the server directory
+ * @param[out] fd Will contain descriptor of the temporary file
+ * @param[out] temp Will contain name of the temporary file, to be passed to
+ * uploadCommit()
+ * @return ok on success, error code otherwise
+ */
+enum codes uploadOpen(const char *path, int *fd, char **temp) {
+	if (!isUploadPathValid(path))
+		return forbidden;
+
+	/* temporary file ".name.XXXXXX" next to the target */
+	int len = strlen(path);
+	const char *slash = strrchr(path, '/');
+	int dirLen = slash ? slash - path + 1 : 0;
+	*temp = (char*) malloc(len + 10);
+	sprintf(*temp, "%.*s.%s.XXXXXX", dirLen, path, &path[dirLen]);
+
+	*fd = mkstemp(*temp);
+	if (*fd < 0) {
+		free(*temp);
+		return errno == ENOENT || errno == ENOTDIR ? notFound : forbidden;
+	}
+	fchmod(*fd, 0644);
+	return ok;
+}
+
+/*!
+ * Ends an upload started with uploadOpen(). If the whole file was received,
+ * it is synced to disk and renamed over the target, otherwise it is removed
+ * @param path Path of the target relative to the server directory
+ * @param fd Descriptor of the temporary file, closed here
+ * @param temp Name of the temporary file, freed here
+ * @param result ok if the whole file was written, error code otherwise
+ * @return created or noContent (file replaced) on success, error code otherwise
+ */
+enum codes uploadCommit(const char *path, int fd, char *temp,
+		enum codes result) {
+	if (result == ok && fsync(fd))
+		result = internalServerError;
+	close(fd);
+
+	if (result == ok) {
+		struct stat attrib;
+		int existed = !stat(path, &attrib);
+		if (existed && S_ISDIR(attrib.st_mode))
+			result = forbidden;
+		else if (rename(temp, path))
+			result = internalServerError;
+		else
+			result = existed ? noContent : created;
+	}
+	if (result != created && result != noContent)
+		unlink(temp);
+	free(temp);
+	return result;
+}
+
+/*!
+ * Copies a request body to a file at its current offset, splicing it where
+ * possible
+ * @param fd File to write to
+ * @param body Reader of the request body
+ * @param chunkSize Size of chunks the body is copied in
+ * @return ok on success, badRequest if the body was truncated,
+ * internalServerError on write failure
+ */
+static enum codes copyBody(int fd, BodyReader *body, int chunkSize) {
+	/* copy through user space only where splice() is not supported */
+	enum codes result = spliceUpload(fd, body, chunkSize);
+	if (result == notImplemented) {
+		result = ok;
+		char *buffer = (char*) malloc(chunkSize);
+		int size;
+		while ((size = bodyRead(body, buffer, chunkSize)) > 0)
+			if (fsWrite(fd, buffer, size)) {
+				result = internalServerError;
+				break;
+			}
+		if (size < 0)
+			result = badRequest;
+		free(buffer);
+	}
+	return result;
+}
+
+/*!
+ * Stores a request body in a file. The body is spliced, or copied in
+ * fixed-size chunks, to a temporary file in the target directory, which is
+ * then renamed over the target, so readers never see a partial upload
+ * @param path Path of the file relative to the server directory
+ * @param body Reader of the request body
+ * @param chunkSize Size of chunks the body is copied in
+ * @return created or noContent (file replaced) on success, error code otherwise
+ */
+enum codes receiveUpload(const char *path, BodyReader *body, int chunkSize) {
+	int fd;
+	char *temp;
+	enum codes result = uploadOpen(path, &fd, &temp);
+	if (result != ok)
+		return result;
+	return uploadCommit(path, fd, temp, copyBody(fd, body, chunkSize));
+}
+
+/*!
+ * Parses value of Content-Range header of a request, "bytes first-last/total"
+ * @param value Value of the header
+ * @param[out] range Will contain the range
+ * @return 0 on success, -1 if the value is malformed
+ */
+int parseContentRange(const char *value, ContentRange *range) {
+	int end = 0;
+	sscanf(value, "bytes %lld-%lld/%lld%n", &range->first, &range->last,
+			&range->total, &end);
+	if (!end || value[end] || range->first < 0 || range->first > range->last
+			|| range->last >= range->total)
+		return -1;
+	return 0;
+}
+
+/*!
+ * Gives name of the file a resumable upload is gathered in, ".name.part" next
+ * to the target
+ * @param path Path of the target relative to the server directory
+ * @return Name of the file, to be freed by the caller
+ */
+char* partialUploadPath(const char *path) {
+	const char *slash = strrchr(path, '/');
+	int dirLen = slash ? slash - path + 1 : 0;
+	char *part = (char*) malloc(strlen(path) + 7);
+	sprintf(part, "%.*s.%s.part", dirLen, path, &path[dirLen]);
+	return part;
+}
+
+/*!
+ * Gets the length of a resumable upload received so far
+ * @param path Path of the target relative to the server directory
+ * @return Committed length, -1 if no upload of the file is in progress
+ */
+long long partialUploadLength(const char *path) {
+	if (!isUploadPathValid(path))
+		return -1;
+	char *part = partialUploadPath(path);
+	struct stat attrib;
+	int found = !fsStatat(part, &attrib);
+	free(part);
+	return found ? attrib.st_size : -1;
+}
+
+/*!
+ * Stores one range of a resumable upload. Ranges are gathered in a partial
+ * file, written at their offsets and synced, so that after a dropped
+ * connection the client can continue from the committed length. A range
+ * starting at 0 begins the upload anew. Once the whole file is there, it is
+ * renamed over the target
+ * @param path Path of the file relative to the server directory
+ * @param body Reader of the request body, holding exactly the range
+ * @param range Range of the file carried by the body
+ * @param chunkSize Size of chunks the body is copied in
+ * @param[out] committed Will contain length of the partial file, which is
+ * on disk, or -1 if the file couldn't be opened
+ * @return created or noContent when the upload is complete, accepted when
+ * more ranges are needed, rangeNotSatisfiable if the range would leave a gap,
+ * error code otherwise
+ */
+enum codes receivePartialUpload(const char *path, BodyReader *body,
+		const ContentRange *range, int chunkSize, long long *committed) {
+	*committed = -1;
+	if (!isUploadPathValid(path))
+		return forbidden;
+	if (body->chunked || body->remaining != range->last - range->first + 1)
+		return badRequest;
+
+	char *part = partialUploadPath(path);
+	int fd = fsOpenat(part, O_WRONLY | O_CREAT, 0644);
+	if (fd < 0) {
+		free(part);
+		return errno == ENOENT || errno == ENOTDIR ? notFound : forbidden;
+	}
+
+	/* one request at a time writes to an upload */
+	enum codes result = ok;
+	struct stat attrib;
+	if (flock(fd, LOCK_EX) || fstat(fd, &attrib))
+		result = internalServerError;
+	else if (!range->first) {
+		if (ftruncate(fd, 0))
+			result = internalServerError;
+	} else if (range->first > attrib.st_size || attrib.st_size
+			> range->total)
+		result = rangeNotSatisfiable;
+
+	/* whatever arrives is kept, even if the body ends early */
+	if (result == ok) {
+		if (lseek(fd, range->first, SEEK_SET) < 0)
+			result = internalServerError;
+		else
+			result = copyBody(fd, body, chunkSize);
+		if (fdatasync(fd) && result == ok)
+			result = internalServerError;
+	}
+	if (!fstat(fd, &attrib))
+		*committed = attrib.st_size;
+
+	if (result == ok && *committed < range->total)
+		result = accepted;
+	else if (result == ok) {
+		struct stat target;
+		int existed = !stat(path, &target);
+		if (existed && S_ISDIR(target.st_mode))
+			result = forbidden;
+		else if (rename(part, path))
+			result = internalServerError;
+		else
+			result = existed ? noContent : created;
+	}
+	close(fd);
+	free(part);
+	return result;
+}